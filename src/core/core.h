@@ -97,6 +97,8 @@ public:
     // Special constructor.
     // Throws an exception if the vector is of the wrong size.
     static SharpnessGauge from_vector(const std::vector<unsigned int>&);
+    // The inverse of from_vector().
+    std::vector<unsigned int> to_vector() const;
     static double sharpness_level_to_raw_sharpness_modifier(SharpnessLevel);
 
     // Constructs a new SharpnessGauge that is the result of applying handicraft to
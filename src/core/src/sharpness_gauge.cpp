@@ -70,6 +70,11 @@ SharpnessGauge SharpnessGauge::from_vector(const std::vector<unsigned int>& vec)
 }
 
 
+std::vector<unsigned int> SharpnessGauge::to_vector() const {
+    return std::vector<unsigned int>(this->hits.begin(), this->hits.end());
+}
+
+
 double SharpnessGauge::sharpness_level_to_raw_sharpness_modifier(const SharpnessLevel lvl) {
     switch (lvl) {
         case SharpnessLevel::red:    return k_RAW_SHARPNESS_MODIFIER_RED;
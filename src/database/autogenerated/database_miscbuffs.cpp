@@ -4,6 +4,7 @@
  * Do not edit directly!
  */
 
+#include <stdexcept>
 #include <unordered_map>
 
 #include "../database_miscbuffs.h"
@@ -172,8 +173,12 @@ static const std::unordered_map<std::string, MiscBuff> g_miscbuffs_map = {
 };
 
 
-const MiscBuff& get_miscbuff(const std::string& miscbuff_id) noexcept {
-    return g_miscbuffs_map.at(miscbuff_id);
+const MiscBuff& get_miscbuff(const std::string& miscbuff_id) {
+    try {
+        return g_miscbuffs_map.at(miscbuff_id);
+    } catch (const std::out_of_range&) {
+        throw std::out_of_range("Misc buff ID '" + miscbuff_id + "' not found in the database.");
+    }
 }
 
 
@@ -4,6 +4,7 @@
  * Do not edit directly!
  */
 
+#include <stdexcept>
 #include <unordered_map>
 
 #include "../database_skills.h"
@@ -2127,6 +2128,179 @@ static const std::unordered_map<std::string, const SetBonus*> g_setbonus_map = {
 };
 
 
+const std::array<const Skill*, g_num_skills> g_all_skills = {
+    &g_skill_adrenaline,
+    &g_skill_affinity_sliding,
+    &g_skill_agitator,
+    &g_skill_agitator_secret,
+    &g_skill_airborne,
+    &g_skill_aquatic_polar_mobility,
+    &g_skill_artillery,
+    &g_skill_artillery_secret,
+    &g_skill_attack_boost,
+    &g_skill_bbq_master,
+    &g_skill_blast_attack,
+    &g_skill_blast_functionality,
+    &g_skill_blast_resistance,
+    &g_skill_bleeding_resistance,
+    &g_skill_blight_resistance,
+    &g_skill_blindsider,
+    &g_skill_bludgeoner,
+    &g_skill_bombardier,
+    &g_skill_bombardier_secret,
+    &g_skill_botanist,
+    &g_skill_bow_charge_plus,
+    &g_skill_capacity_boost,
+    &g_skill_capture_master,
+    &g_skill_carving_master,
+    &g_skill_carving_pro,
+    &g_skill_cliffhanger,
+    &g_skill_coalescence,
+    &g_skill_coldproof,
+    &g_skill_constitution,
+    &g_skill_critical_boost,
+    &g_skill_critical_draw,
+    &g_skill_critical_element,
+    &g_skill_critical_eye,
+    &g_skill_critical_status,
+    &g_skill_defense_boost,
+    &g_skill_detector,
+    &g_skill_divine_blessing,
+    &g_skill_divine_blessing_secret,
+    &g_skill_dragon_attack,
+    &g_skill_dragon_resistance,
+    &g_skill_dragonvein_awakening,
+    &g_skill_dungmaster,
+    &g_skill_earplugs,
+    &g_skill_effluvia_resistance,
+    &g_skill_effluvial_expert,
+    &g_skill_elderseal_boost,
+    &g_skill_element_acceleration,
+    &g_skill_elemental_airborne,
+    &g_skill_entomologist,
+    &g_skill_evade_extender,
+    &g_skill_evade_window,
+    &g_skill_fire_attack,
+    &g_skill_fire_resistance,
+    &g_skill_flinch_free,
+    &g_skill_focus,
+    &g_skill_foragers_luck,
+    &g_skill_fortify,
+    &g_skill_free_elem_ammo_up,
+    &g_skill_free_meal,
+    &g_skill_free_meal_secret,
+    &g_skill_frostcraft,
+    &g_skill_full_bloom_gratitude,
+    &g_skill_full_blooms_gift,
+    &g_skill_gaias_veil,
+    &g_skill_geologist,
+    &g_skill_good_luck,
+    &g_skill_gratitudes_blessing,
+    &g_skill_gratitudes_gift,
+    &g_skill_great_luck,
+    &g_skill_guard,
+    &g_skill_guard_up,
+    &g_skill_guts,
+    &g_skill_handicraft,
+    &g_skill_hasten_recovery,
+    &g_skill_health_boost,
+    &g_skill_heat_guard,
+    &g_skill_heavy_artillery,
+    &g_skill_heroics,
+    &g_skill_heroics_secret,
+    &g_skill_honey_hunter,
+    &g_skill_horn_maestro,
+    &g_skill_hunger_resistance,
+    &g_skill_ice_attack,
+    &g_skill_ice_resistance,
+    &g_skill_intimidator,
+    &g_skill_iron_skin,
+    &g_skill_item_prolonger,
+    &g_skill_joys_gift,
+    &g_skill_joys_gratitude,
+    &g_skill_jump_master,
+    &g_skill_latent_power,
+    &g_skill_latent_power_secret,
+    &g_skill_leap_of_faith,
+    &g_skill_marathon_runner,
+    &g_skill_master_fisher,
+    &g_skill_master_gatherer,
+    &g_skill_master_mounter,
+    &g_skill_masters_touch,
+    &g_skill_maximum_might,
+    &g_skill_maximum_might_secret,
+    &g_skill_minds_eye_ballistics,
+    &g_skill_muck_resistance,
+    &g_skill_mushroomancer,
+    &g_skill_non_elemental_boost,
+    &g_skill_normal_shots,
+    &g_skill_nullify_wind_pressure,
+    &g_skill_offensive_guard,
+    &g_skill_palico_rally,
+    &g_skill_paralysis_attack,
+    &g_skill_paralysis_functionality,
+    &g_skill_paralysis_resistance,
+    &g_skill_partbreaker,
+    &g_skill_peak_performance,
+    &g_skill_piercing_shots,
+    &g_skill_poison_attack,
+    &g_skill_poison_duration_up,
+    &g_skill_poison_functionality,
+    &g_skill_poison_resistance,
+    &g_skill_power_prolonger,
+    &g_skill_pro_transporter,
+    &g_skill_protective_polish,
+    &g_skill_provoker,
+    &g_skill_punishing_draw,
+    &g_skill_quick_sheath,
+    &g_skill_razor_sharp_spare_shot,
+    &g_skill_recovery_speed,
+    &g_skill_recovery_up,
+    &g_skill_resentment,
+    &g_skill_resuscitate,
+    &g_skill_safe_landing,
+    &g_skill_scenthound,
+    &g_skill_scholar,
+    &g_skill_scoutfly_range_up,
+    &g_skill_sleep_attack,
+    &g_skill_sleep_functionality,
+    &g_skill_sleep_resistance,
+    &g_skill_slinger_ammo_secret,
+    &g_skill_slinger_capacity,
+    &g_skill_slugger,
+    &g_skill_slugger_secret,
+    &g_skill_special_ammo_boost,
+    &g_skill_speed_crawler,
+    &g_skill_speed_eating,
+    &g_skill_speed_sharpening,
+    &g_skill_spread_power_shots,
+    &g_skill_stamina_cap_up,
+    &g_skill_stamina_surge,
+    &g_skill_stamina_thief,
+    &g_skill_stamina_thief_secret,
+    &g_skill_stealth,
+    &g_skill_stun_resistance,
+    &g_skill_super_recovery,
+    &g_skill_survival_expert,
+    &g_skill_thunder_attack,
+    &g_skill_thunder_resistance,
+    &g_skill_tool_specialist,
+    &g_skill_tool_specialist_secret,
+    &g_skill_tremor_resistance,
+    &g_skill_true_critical_element,
+    &g_skill_true_critical_status,
+    &g_skill_true_dragonvein_awakening,
+    &g_skill_true_element_acceleration,
+    &g_skill_true_gaias_veil,
+    &g_skill_true_razor_sharp_spare_shot,
+    &g_skill_water_attack,
+    &g_skill_water_resistance,
+    &g_skill_weakness_exploit,
+    &g_skill_wide_range,
+    &g_skill_windproof,
+};
+
+
 const std::array<const SetBonus*, 40> g_all_setbonuses = {
     &g_setbonus_ancient_divinity,
     &g_setbonus_anjanath_dominance,
@@ -2171,13 +2345,21 @@ const std::array<const SetBonus*, 40> g_all_setbonuses = {
 };
 
 
-const Skill* get_skill(const std::string& skill_id) noexcept {
-    return g_skills_map.at(skill_id);
+const Skill* get_skill(const std::string& skill_id) {
+    try {
+        return g_skills_map.at(skill_id);
+    } catch (const std::out_of_range&) {
+        throw std::out_of_range("Skill ID '" + skill_id + "' not found in the database.");
+    }
 }
 
 
-const SetBonus* get_setbonus(const std::string& setbonus_id) noexcept {
-    return g_setbonus_map.at(setbonus_id);
+const SetBonus* get_setbonus(const std::string& setbonus_id) {
+    try {
+        return g_setbonus_map.at(setbonus_id);
+    } catch (const std::out_of_range&) {
+        throw std::out_of_range("Set bonus ID '" + setbonus_id + "' not found in the database.");
+    }
 }
 
 
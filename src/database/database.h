@@ -6,6 +6,7 @@
 #ifndef MHWIBS_DATABASE_H
 #define MHWIBS_DATABASE_H
 
+#include <cstdint>
 #include <map>
 #include <unordered_set>
 #include <unordered_map>
@@ -16,6 +17,11 @@
 namespace MHWIBuildSearch {
 
 
+// Binary database snapshots. See database_snapshot.cpp.
+class SnapshotWriter;
+class SnapshotReader;
+
+
 /****************************************************************************************
  * Decorations Database
  ***************************************************************************************/
@@ -29,6 +35,9 @@ class DecorationsDatabase {
 public:
     // Constructor
     static const DecorationsDatabase read_db_file(const std::string& filename);
+    static const DecorationsDatabase read_snapshot(SnapshotReader&);
+
+    void write_snapshot(SnapshotWriter&) const;
 
     // Access
     const Decoration* at(const std::string& deco_id) const;
@@ -50,6 +59,9 @@ class WeaponsDatabase {
 public:
     // Constructor
     static const WeaponsDatabase read_db_file(const std::string& filename);
+    static const WeaponsDatabase read_snapshot(SnapshotReader&);
+
+    void write_snapshot(SnapshotWriter&) const;
 
     // Access
     const Weapon* at(const std::string& weapon_id) const;
@@ -83,6 +95,9 @@ class ArmourDatabase {
 public:
     // Constructor
     static const ArmourDatabase read_db_file(const std::string& filename);
+    static const ArmourDatabase read_snapshot(SnapshotReader&);
+
+    void write_snapshot(SnapshotWriter&) const;
 
     // Access
     const ArmourPiece* at(const std::string& set_name,
@@ -108,6 +123,9 @@ class CharmsDatabase {
 public:
     // Constructor
     static const CharmsDatabase read_db_file(const std::string& filename);
+    static const CharmsDatabase read_snapshot(SnapshotReader&);
+
+    void write_snapshot(SnapshotWriter&) const;
 
     // Access
     const Charm* at(const std::string& charm_id) const;
@@ -131,11 +149,28 @@ struct Database {
     const CharmsDatabase      charms;
 
     // Constructor
+    // Reads the binary snapshot if it's up-to-date with the JSON database files. Otherwise,
+    // the JSON files are read, and a new snapshot is written for the next run.
     static const Database get_db();
 
+    // Constructor
+    // Always reads the JSON database files. Doesn't touch the snapshot.
+    static const Database read_db_files();
+
+    // Constructor
+    // Throws std::runtime_error if the snapshot is missing, stale, or corrupt.
+    static const Database read_snapshot(const std::string& filename, std::uint64_t source_checksum);
+
+    // Throws std::runtime_error if the snapshot couldn't be written.
+    void write_snapshot(const std::string& filename, std::uint64_t source_checksum) const;
+
+    // Identifies the JSON database files and the compiled-in skills database.
+    // A snapshot is only used if it was written with the same checksum.
+    static std::uint64_t calculate_source_checksum();
+
 private:
     // Constructor
-    Database();
+    Database(DecorationsDatabase, WeaponsDatabase, ArmourDatabase, CharmsDatabase) noexcept;
 };
 
 
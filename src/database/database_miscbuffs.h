@@ -16,7 +16,8 @@ namespace MiscBuffsDatabase
 
 using MHWIBuildSearch::MiscBuff;
 
-const MiscBuff& get_miscbuff(const std::string& miscbuff_id) noexcept;
+// Throws std::out_of_range if the ID doesn't exist.
+const MiscBuff& get_miscbuff(const std::string& miscbuff_id);
 
 } // namespace
 
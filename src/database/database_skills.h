@@ -358,6 +358,8 @@ constexpr std::size_t g_skillnid_weakness_exploit = 166;
 constexpr std::size_t g_skillnid_wide_range = 167;
 constexpr std::size_t g_skillnid_windproof = 168;
 
+constexpr std::size_t g_num_skills = 169;
+
 extern const SetBonus g_setbonus_ancient_divinity;
 extern const SetBonus g_setbonus_anjanath_dominance;
 extern const SetBonus g_setbonus_appreciation_blessing;
@@ -399,11 +401,16 @@ extern const SetBonus g_setbonus_velkhana_divinity;
 extern const SetBonus g_setbonus_zinogre_essence;
 extern const SetBonus g_setbonus_zorah_magdaros_essence;
 
+// Indexed by Skill::nid.
+extern const std::array<const Skill*, g_num_skills> g_all_skills;
+
 extern const std::array<const SetBonus*, 40> g_all_setbonuses;
 
-const Skill* get_skill(const std::string& skill_id) noexcept;
+// Throws std::out_of_range if the ID doesn't exist.
+const Skill* get_skill(const std::string& skill_id);
 
-const SetBonus* get_setbonus(const std::string& setbonus_id) noexcept;
+// Throws std::out_of_range if the ID doesn't exist.
+const SetBonus* get_setbonus(const std::string& setbonus_id);
 
 } // namespace
 
@@ -3,22 +3,84 @@
  * Author: <contact@simshadows.com>
  */
 
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
 #include "../database.h"
+#include "../database_skills.h"
+#include "../../utils/utils.h"
 
 namespace MHWIBuildSearch {
 
 
+static const std::string k_DECOS_PATH   = "data/database_decorations.json";
+static const std::string k_WEAPONS_PATH = "data/database_weapons.json";
+static const std::string k_ARMOUR_PATH  = "data/database_armour.json";
+static const std::string k_CHARMS_PATH  = "data/database_charms.json";
+
+static const std::string k_SNAPSHOT_PATH = "data/database.snapshot";
+
+
 // Constructor
 const Database Database::get_db() {
-    return Database();
+    const std::uint64_t checksum = calculate_source_checksum();
+    try {
+        return read_snapshot(k_SNAPSHOT_PATH, checksum);
+    } catch (const std::exception&) {
+        // Missing, stale, or corrupt. We fall back to the JSON files.
+        // (A corrupt snapshot can fail in other ways than std::runtime_error, such as std::out_of_range
+        // from an out-of-range index, or std::bad_alloc from a bad size.)
+    }
+
+    Database db = read_db_files();
+    try {
+        db.write_snapshot(k_SNAPSHOT_PATH, checksum);
+    } catch (const std::runtime_error&) {
+        // Not being able to write a snapshot only means the next run will also read the JSON files.
+    }
+    return db;
+}
+
+
+// Constructor
+const Database Database::read_db_files() {
+    return Database(DecorationsDatabase::read_db_file(k_DECOS_PATH  ),
+                    WeaponsDatabase    ::read_db_file(k_WEAPONS_PATH),
+                    ArmourDatabase     ::read_db_file(k_ARMOUR_PATH ),
+                    CharmsDatabase     ::read_db_file(k_CHARMS_PATH ));
+}
+
+
+std::uint64_t Database::calculate_source_checksum() {
+    std::uint64_t h = Utils::fnv1a_64(nullptr, 0);
+    for (const std::string& filename : {k_DECOS_PATH, k_WEAPONS_PATH, k_ARMOUR_PATH, k_CHARMS_PATH}) {
+        std::ifstream f(filename, std::ios::binary);
+        const std::string contents {std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
+        h = Utils::fnv1a_64(contents.data(), contents.size(), h);
+    }
+
+    // Snapshots refer to skills and set bonuses by their positions in the compiled-in skills database,
+    // so we also need to know if those positions change.
+    for (const Skill * const skill : SkillsDatabase::g_all_skills) {
+        h = Utils::fnv1a_64(skill->id, std::strlen(skill->id) + 1, h);
+    }
+    for (const SetBonus * const set_bonus : SkillsDatabase::g_all_setbonuses) {
+        h = Utils::fnv1a_64(set_bonus->id, std::strlen(set_bonus->id) + 1, h);
+    }
+    return h;
 }
 
 
-Database::Database()
-    : decos   (DecorationsDatabase::read_db_file("data/database_decorations.json"))
-    , weapons (WeaponsDatabase    ::read_db_file("data/database_weapons.json"    ))
-    , armour  (ArmourDatabase     ::read_db_file("data/database_armour.json"     ))
-    , charms  (CharmsDatabase     ::read_db_file("data/database_charms.json"     ))
+Database::Database(DecorationsDatabase new_decos,
+                   WeaponsDatabase     new_weapons,
+                   ArmourDatabase      new_armour,
+                   CharmsDatabase      new_charms) noexcept
+    : decos   (std::move(new_decos  ))
+    , weapons (std::move(new_weapons))
+    , armour  (std::move(new_armour ))
+    , charms  (std::move(new_charms ))
 {
 }
 
@@ -0,0 +1,538 @@
+/*
+ * File: database_snapshot.cpp
+ * Author: <contact@simshadows.com>
+ *
+ * Binary snapshots of the validated database, so we don't need to parse and validate the
+ * JSON database files on every run.
+ *
+ * A snapshot is only a local cache, so all values are native-endian 32-bit words:
+ *
+ *      Header:         magic, format version,
+ *                      source checksum (low word, high word),
+ *                      body checksum (low word, high word),
+ *                      number of body words
+ *      String table:   number of strings,
+ *                      then for each string: its length in bytes, followed by its bytes padded out to
+ *                      a whole number of words
+ *      Body:           decorations, weapons, armour, then charms (see each write_snapshot())
+ *
+ * Records refer to strings by string table index, to skills by Skill::nid, and to set bonuses by
+ * their index in SkillsDatabase::g_all_setbonuses. k_NULL_REF stands in for nullptr.
+ */
+
+#include <assert.h>
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <stdexcept>
+
+#include "../database.h"
+#include "../database_skills.h"
+#include "../../utils/utils.h"
+
+
+namespace MHWIBuildSearch {
+
+
+static constexpr std::uint32_t k_SNAPSHOT_MAGIC   = 0x5342484d; // "MHBS"
+static constexpr std::uint32_t k_SNAPSHOT_VERSION = 1;
+
+static constexpr std::size_t k_HEADER_WORDS = 7;
+
+static constexpr std::uint32_t k_NULL_REF = 0xffffffff;
+
+
+/****************************************************************************************
+ * SnapshotWriter and SnapshotReader
+ ***************************************************************************************/
+
+
+class SnapshotWriter {
+    std::vector<std::uint32_t> body;
+
+    std::vector<const std::string*> strings;
+    std::unordered_map<std::string, std::uint32_t> string_indices;
+public:
+    void put(const std::size_t v) {
+        assert(v < k_NULL_REF);
+        this->body.emplace_back(static_cast<std::uint32_t>(v));
+    }
+
+    template<class E>
+    void put_enum(const E v) {
+        this->put(static_cast<std::size_t>(v));
+    }
+
+    void put_str(const std::string& s) {
+        const auto result = this->string_indices.emplace(s, this->strings.size());
+        if (result.second) this->strings.emplace_back(&result.first->first);
+        this->put(result.first->second);
+    }
+
+    void put_skill(const Skill * const skill) {
+        if (skill) {
+            this->put(skill->nid);
+        } else {
+            this->body.emplace_back(k_NULL_REF);
+        }
+    }
+
+    void put_set_bonus(const SetBonus * const set_bonus) {
+        if (set_bonus) {
+            const auto& all = SkillsDatabase::g_all_setbonuses;
+            const auto result = std::find(all.begin(), all.end(), set_bonus);
+            if (result == all.end()) throw std::logic_error("Set bonus is not in the skills database.");
+            this->put(std::distance(all.begin(), result));
+        } else {
+            this->body.emplace_back(k_NULL_REF);
+        }
+    }
+
+    void save(const std::string& filename, const std::uint64_t source_checksum) const {
+        std::vector<std::uint32_t> words;
+
+        words.emplace_back(this->strings.size());
+        for (const std::string * const s : this->strings) {
+            const std::size_t begin = words.size();
+            words.emplace_back(s->size());
+            words.resize(begin + 1 + ((s->size() + 3) / 4), 0);
+            std::memcpy(&words[begin + 1], s->data(), s->size());
+        }
+        words.insert(words.end(), this->body.begin(), this->body.end());
+
+        const std::uint64_t body_checksum = Utils::fnv1a_64(words.data(), words.size() * 4);
+        const std::array<std::uint32_t, k_HEADER_WORDS> header = {
+            k_SNAPSHOT_MAGIC,
+            k_SNAPSHOT_VERSION,
+            static_cast<std::uint32_t>(source_checksum),
+            static_cast<std::uint32_t>(source_checksum >> 32),
+            static_cast<std::uint32_t>(body_checksum),
+            static_cast<std::uint32_t>(body_checksum >> 32),
+            static_cast<std::uint32_t>(words.size()),
+        };
+
+        // We write to a temporary file first so concurrent runs never see a partially-written snapshot.
+        const std::string tmp_filename = filename + ".tmp" + std::to_string(std::random_device()());
+        {
+            std::ofstream f(tmp_filename, std::ios::binary | std::ios::trunc);
+            f.write(reinterpret_cast<const char*>(header.data()), header.size() * 4);
+            f.write(reinterpret_cast<const char*>(words.data()), words.size() * 4);
+            if (!f) {
+                f.close();
+                std::remove(tmp_filename.c_str());
+                throw std::runtime_error("Failed to write database snapshot.");
+            }
+        }
+        if (std::rename(tmp_filename.c_str(), filename.c_str())) {
+            std::remove(tmp_filename.c_str());
+            throw std::runtime_error("Failed to write database snapshot.");
+        }
+    }
+};
+
+
+class SnapshotReader {
+    std::vector<std::uint32_t> words;
+    std::size_t next_index;
+
+    std::vector<std::string> strings;
+public:
+    // Throws std::runtime_error if the snapshot is missing, stale, or corrupt.
+    SnapshotReader(const std::string& filename, const std::uint64_t source_checksum)
+        : words      {}
+        , next_index {0}
+        , strings    {}
+    {
+        std::ifstream f(filename, std::ios::binary);
+        if (!f) throw std::runtime_error("Database snapshot not found.");
+        const std::string contents {std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
+
+        std::array<std::uint32_t, k_HEADER_WORDS> header;
+        if (contents.size() < (header.size() * 4)) this->throw_corrupt();
+        std::memcpy(header.data(), contents.data(), header.size() * 4);
+
+        const std::uint64_t header_source_checksum = (std::uint64_t(header[3]) << 32) | header[2];
+        const std::uint64_t header_body_checksum   = (std::uint64_t(header[5]) << 32) | header[4];
+        if ((header[0] != k_SNAPSHOT_MAGIC)
+                || (header[1] != k_SNAPSHOT_VERSION)
+                || (header_source_checksum != source_checksum)) {
+            throw std::runtime_error("Database snapshot is stale.");
+        }
+
+        if (contents.size() != ((header.size() + std::size_t(header[6])) * 4)) this->throw_corrupt();
+        this->words.resize(header[6]);
+        std::memcpy(this->words.data(), contents.data() + (header.size() * 4), this->words.size() * 4);
+        if (Utils::fnv1a_64(this->words.data(), this->words.size() * 4) != header_body_checksum) {
+            this->throw_corrupt();
+        }
+
+        const std::size_t num_strings = this->get();
+        for (std::size_t i = 0; i < num_strings; ++i) {
+            const std::size_t len = this->get();
+            const std::size_t len_words = (len + 3) / 4;
+            if (len_words > (this->words.size() - this->next_index)) this->throw_corrupt();
+            const char * const begin = reinterpret_cast<const char*>(&this->words[this->next_index]);
+            this->strings.emplace_back(begin, len);
+            this->next_index += len_words;
+        }
+    }
+
+    std::size_t get() {
+        if (this->next_index >= this->words.size()) this->throw_corrupt();
+        return this->words[this->next_index++];
+    }
+
+    template<class E>
+    E get_enum() {
+        return static_cast<E>(this->get());
+    }
+
+    // Bounds-checked get(), for element counts that we want to allocate for.
+    std::size_t get_count() {
+        const std::size_t v = this->get();
+        if (v > (this->words.size() - this->next_index)) this->throw_corrupt();
+        return v;
+    }
+
+    std::string get_str() {
+        const std::size_t i = this->get();
+        if (i >= this->strings.size()) this->throw_corrupt();
+        return this->strings[i];
+    }
+
+    // Never returns nullptr.
+    const Skill* get_skill() {
+        const std::size_t i = this->get();
+        if (i >= SkillsDatabase::g_all_skills.size()) this->throw_corrupt();
+        return SkillsDatabase::g_all_skills[i];
+    }
+
+    const Skill* get_skill_or_null() {
+        if ((this->next_index < this->words.size()) && (this->words[this->next_index] == k_NULL_REF)) {
+            ++this->next_index;
+            return nullptr;
+        }
+        return this->get_skill();
+    }
+
+    const SetBonus* get_set_bonus_or_null() {
+        const std::size_t i = this->get();
+        if (i == k_NULL_REF) return nullptr;
+        if (i >= SkillsDatabase::g_all_setbonuses.size()) this->throw_corrupt();
+        return SkillsDatabase::g_all_setbonuses[i];
+    }
+
+    void check_end() const {
+        if (this->next_index != this->words.size()) this->throw_corrupt();
+    }
+
+private:
+    [[noreturn]] static void throw_corrupt() {
+        throw std::runtime_error("Database snapshot is corrupt.");
+    }
+};
+
+
+/****************************************************************************************
+ * Decorations
+ ***************************************************************************************/
+
+
+// Per decoration: id, name, slot size, number of skills, then (skill, level) for each skill.
+void DecorationsDatabase::write_snapshot(SnapshotWriter& w) const {
+    w.put(this->decorations_store.size());
+    for (const Decoration * const deco : this->get_all()) {
+        w.put_str(deco->id);
+        w.put_str(deco->name);
+        w.put(deco->slot_size);
+        w.put(deco->skills.size());
+        for (const auto& e : deco->skills) {
+            w.put_skill(e.first);
+            w.put(e.second);
+        }
+    }
+}
+
+
+const DecorationsDatabase DecorationsDatabase::read_snapshot(SnapshotReader& r) {
+    DecorationsDatabase new_db;
+    const std::size_t num_decos = r.get_count();
+    for (std::size_t i = 0; i < num_decos; ++i) {
+        std::string id = r.get_str();
+        std::string name = r.get_str();
+        const unsigned int slot_size = r.get();
+
+        std::vector<std::pair<const Skill*, unsigned int>> skills;
+        const std::size_t num_skills = r.get_count();
+        for (std::size_t j = 0; j < num_skills; ++j) {
+            const Skill * const skill = r.get_skill();
+            skills.emplace_back(skill, r.get());
+        }
+
+        std::string id_copy = id;
+        new_db.decorations_store.insert({std::move(id), std::make_shared<Decoration>(std::move(id_copy),
+                                                                                     std::move(name),
+                                                                                     slot_size,
+                                                                                     std::move(skills)) });
+    }
+    return new_db;
+}
+
+
+/****************************************************************************************
+ * Weapons
+ ***************************************************************************************/
+
+
+// Per weapon: id, class, name, rarity, true raw, affinity, element/status visibility, type, and value,
+// number of deco slots, then each deco slot, skill, augmentation scheme, upgrade scheme,
+// each maximum sharpness value, then constant sharpness.
+void WeaponsDatabase::write_snapshot(SnapshotWriter& w) const {
+    w.put(this->all_weapons.size());
+    for (const Weapon& weapon : this->all_weapons) {
+        w.put_str(weapon.id);
+        w.put_enum(weapon.weapon_class);
+        w.put_str(weapon.name);
+        w.put(weapon.rarity);
+        w.put(weapon.true_raw);
+        w.put(static_cast<std::uint32_t>(weapon.affinity)); // Two's complement.
+        w.put_enum(weapon.elestat_visibility);
+        w.put_enum(weapon.elestat_type);
+        w.put(weapon.elestat_value);
+        w.put(weapon.deco_slots.size());
+        for (const unsigned int deco_size : weapon.deco_slots) {
+            w.put(deco_size);
+        }
+        w.put_skill(weapon.skill);
+        w.put_enum(weapon.augmentation_scheme);
+        w.put_enum(weapon.upgrade_scheme);
+        for (const unsigned int hits : weapon.maximum_sharpness.to_vector()) {
+            w.put(hits);
+        }
+        w.put(weapon.is_constant_sharpness);
+    }
+}
+
+
+const WeaponsDatabase WeaponsDatabase::read_snapshot(SnapshotReader& r) {
+    WeaponsDatabase new_db;
+    const std::size_t num_weapons = r.get_count();
+    new_db.all_weapons.reserve(num_weapons);
+    for (std::size_t i = 0; i < num_weapons; ++i) {
+        std::string id = r.get_str();
+        const WeaponClass weapon_class = r.get_enum<WeaponClass>();
+        std::string name = r.get_str();
+        const unsigned int rarity = r.get();
+        const unsigned int true_raw = r.get();
+        const int affinity = static_cast<std::int32_t>(r.get());
+        const EleStatVisibility elestat_visibility = r.get_enum<EleStatVisibility>();
+        const EleStatType elestat_type = r.get_enum<EleStatType>();
+        const unsigned int elestat_value = r.get();
+
+        std::vector<unsigned int> deco_slots;
+        const std::size_t num_deco_slots = r.get_count();
+        for (std::size_t j = 0; j < num_deco_slots; ++j) {
+            deco_slots.emplace_back(r.get());
+        }
+
+        const Skill * const skill = r.get_skill_or_null();
+        const WeaponAugmentationScheme augmentation_scheme = r.get_enum<WeaponAugmentationScheme>();
+        const WeaponUpgradeScheme upgrade_scheme = r.get_enum<WeaponUpgradeScheme>();
+
+        std::vector<unsigned int> maximum_sharpness;
+        for (std::size_t j = 0; j < k_SHARPNESS_LEVELS; ++j) {
+            maximum_sharpness.emplace_back(r.get());
+        }
+        const bool is_constant_sharpness = r.get();
+
+        new_db.all_weapons.push_back(Weapon {std::move(id),
+                                             weapon_class,
+                                             std::move(name),
+                                             rarity,
+                                             true_raw,
+                                             affinity,
+                                             elestat_visibility,
+                                             elestat_type,
+                                             elestat_value,
+                                             std::move(deco_slots),
+                                             skill,
+                                             augmentation_scheme,
+                                             upgrade_scheme,
+                                             SharpnessGauge::from_vector(maximum_sharpness),
+                                             is_constant_sharpness });
+    }
+    return new_db;
+}
+
+
+/****************************************************************************************
+ * Armour
+ ***************************************************************************************/
+
+
+// Per set: set name, tier, piece name prefix, rarity, set bonus, then number of pieces.
+// Per piece: slot, variant, number of deco slots, then each deco slot, number of skills,
+// then (skill, level) for each skill, then the piece name postfix.
+void ArmourDatabase::write_snapshot(SnapshotWriter& w) const {
+    w.put(this->armour_sets.size());
+    for (const auto& e : this->armour_sets) {
+        const ArmourSet& armour_set = *e.second;
+        w.put_str(armour_set.set_name);
+        w.put_enum(armour_set.tier);
+        w.put_str(armour_set.piece_name_prefix);
+        w.put(armour_set.rarity);
+        w.put_set_bonus(armour_set.set_bonus);
+        w.put(armour_set.pieces.size());
+        for (const std::shared_ptr<ArmourPiece>& piece : armour_set.pieces) {
+            w.put_enum(piece->slot);
+            w.put_enum(piece->variant);
+            w.put(piece->deco_slots.size());
+            for (const unsigned int deco_size : piece->deco_slots) {
+                w.put(deco_size);
+            }
+            w.put(piece->skills.size());
+            for (const auto& ee : piece->skills) {
+                w.put_skill(ee.first);
+                w.put(ee.second);
+            }
+            w.put_str(piece->piece_name_postfix);
+        }
+    }
+}
+
+
+const ArmourDatabase ArmourDatabase::read_snapshot(SnapshotReader& r) {
+    ArmourDatabase new_db;
+    const std::size_t num_sets = r.get_count();
+    for (std::size_t i = 0; i < num_sets; ++i) {
+        std::string set_name = r.get_str();
+        const Tier tier = r.get_enum<Tier>();
+        std::string piece_name_prefix = r.get_str();
+        const unsigned int rarity = r.get();
+        const SetBonus * const set_bonus = r.get_set_bonus_or_null();
+
+        std::vector<std::shared_ptr<ArmourPiece>> pieces;
+        const std::size_t num_pieces = r.get_count();
+        for (std::size_t j = 0; j < num_pieces; ++j) {
+            const ArmourSlot slot = r.get_enum<ArmourSlot>();
+            const ArmourVariant variant = r.get_enum<ArmourVariant>();
+
+            std::vector<unsigned int> deco_slots;
+            const std::size_t num_deco_slots = r.get_count();
+            for (std::size_t k = 0; k < num_deco_slots; ++k) {
+                deco_slots.emplace_back(r.get());
+            }
+
+            std::vector<std::pair<const Skill*, unsigned int>> skills;
+            const std::size_t num_skills = r.get_count();
+            for (std::size_t k = 0; k < num_skills; ++k) {
+                const Skill * const skill = r.get_skill();
+                skills.emplace_back(skill, r.get());
+            }
+
+            pieces.emplace_back(std::make_shared<ArmourPiece>(slot,
+                                                              variant,
+                                                              std::move(deco_slots),
+                                                              std::move(skills),
+                                                              r.get_str(),
+                                                              nullptr, // We adjust this later!
+                                                              set_bonus ));
+        }
+
+        std::pair<std::string, Tier> full_key = {set_name, tier};
+        new_db.armour_sets.insert({std::move(full_key), std::make_shared<ArmourSet>(std::move(set_name),
+                                                                                    tier,
+                                                                                    std::move(piece_name_prefix),
+                                                                                    rarity,
+                                                                                    set_bonus,
+                                                                                    std::move(pieces)) });
+    }
+
+    // Same as read_db_file(), we set the pointers back to each piece's armour set.
+    for (auto& e : new_db.armour_sets) {
+        ArmourSet* armour_set = e.second.get();
+        for (std::shared_ptr<ArmourPiece>& ee : armour_set->pieces) {
+            ee->set = armour_set;
+        }
+    }
+    return new_db;
+}
+
+
+/****************************************************************************************
+ * Charms
+ ***************************************************************************************/
+
+
+// Per charm: id, name, max charm level, number of skills, then each skill.
+void CharmsDatabase::write_snapshot(SnapshotWriter& w) const {
+    w.put(this->charms_map.size());
+    for (const Charm * const charm : this->get_all()) {
+        w.put_str(charm->id);
+        w.put_str(charm->name);
+        w.put(charm->max_charm_lvl);
+        w.put(charm->skills.size());
+        for (const Skill * const skill : charm->skills) {
+            w.put_skill(skill);
+        }
+    }
+}
+
+
+const CharmsDatabase CharmsDatabase::read_snapshot(SnapshotReader& r) {
+    CharmsDatabase new_db;
+    const std::size_t num_charms = r.get_count();
+    for (std::size_t i = 0; i < num_charms; ++i) {
+        std::string id = r.get_str();
+        std::string name = r.get_str();
+        const unsigned int max_charm_lvl = r.get();
+
+        std::vector<const Skill*> skills;
+        const std::size_t num_skills = r.get_count();
+        for (std::size_t j = 0; j < num_skills; ++j) {
+            skills.emplace_back(r.get_skill());
+        }
+
+        std::string id_copy = id;
+        new_db.charms_map.insert({std::move(id), std::make_shared<Charm>(std::move(id_copy),
+                                                                         std::move(name),
+                                                                         max_charm_lvl,
+                                                                         std::move(skills)) });
+    }
+    return new_db;
+}
+
+
+/****************************************************************************************
+ * Database Manager
+ ***************************************************************************************/
+
+
+const Database Database::read_snapshot(const std::string& filename, const std::uint64_t source_checksum) {
+    SnapshotReader r(filename, source_checksum);
+    // Function arguments have an unspecified evaluation order, so we read each part first.
+    DecorationsDatabase new_decos   = DecorationsDatabase::read_snapshot(r);
+    WeaponsDatabase     new_weapons = WeaponsDatabase    ::read_snapshot(r);
+    ArmourDatabase      new_armour  = ArmourDatabase     ::read_snapshot(r);
+    CharmsDatabase      new_charms  = CharmsDatabase     ::read_snapshot(r);
+    r.check_end();
+    return Database(std::move(new_decos), std::move(new_weapons), std::move(new_armour), std::move(new_charms));
+}
+
+
+void Database::write_snapshot(const std::string& filename, const std::uint64_t source_checksum) const {
+    SnapshotWriter w;
+    this->decos.write_snapshot(w);
+    this->weapons.write_snapshot(w);
+    this->armour.write_snapshot(w);
+    this->charms.write_snapshot(w);
+    w.save(filename, source_checksum);
+}
+
+
+} // namespace
+
@@ -4,6 +4,7 @@
  */
 
 #include <assert.h>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <cmath>
@@ -105,6 +106,38 @@ void no_args_cmd() {
 }
 
 
+// Reads the optional flags that follow "search <file>" or "serve".
+// Returns false if the flags are invalid, or if they can't be used together.
+static bool parse_search_options(const int argc, char** argv, SearchOptions& options) {
+    for (int i = 0; i < argc; ++i) {
+        if ((std::strcmp(argv[i], "--threads") == 0) && (i + 1 < argc)) {
+            const int v = std::atoi(argv[++i]);
+            if (v <= 0) return false;
+            options.num_threads = v;
+        } else if ((std::strcmp(argv[i], "--top") == 0) && (i + 1 < argc)) {
+            const int v = std::atoi(argv[++i]);
+            if (v <= 0) return false;
+            options.num_results = v;
+        } else if (std::strcmp(argv[i], "--distinct-weapons") == 0) {
+            options.distinct_weapons = true;
+        } else if ((std::strcmp(argv[i], "--memory-budget") == 0) && (i + 1 < argc)) {
+            const int v = std::atoi(argv[++i]);
+            if (v <= 0) return false;
+            options.memory_budget_mib = v;
+        } else if (std::strcmp(argv[i], "--reuse-armour-combos") == 0) {
+            options.reuse_armour_combos = true;
+        } else if ((std::strcmp(argv[i], "--results-jsonl") == 0) && (i + 1 < argc)) {
+            options.results_jsonl_path = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    // (See SearchOptions::memory_budget_mib.)
+    if (options.memory_budget_mib && (options.num_results > 1)) return false;
+    return true;
+}
+
+
 } // namespace
 
 
@@ -114,8 +147,20 @@ int main(int argc, char** argv) {
 
     auto start_t = std::chrono::steady_clock::now();
 
-    if ((argc == 3) && (std::strcmp(argv[1], "search") == 0)) {
-        MHWIBuildSearch::search_cmd(std::string(argv[2]));
+    if ((argc >= 3) && (std::strcmp(argv[1], "search") == 0)) {
+        MHWIBuildSearch::SearchOptions options;
+        if (!MHWIBuildSearch::parse_search_options(argc - 3, argv + 3, options)) {
+            std::cerr << "Invalid command arguments." << std::endl;
+            return 1;
+        }
+        MHWIBuildSearch::search_cmd(std::string(argv[2]), options);
+    } else if ((argc >= 2) && (std::strcmp(argv[1], "serve") == 0)) {
+        MHWIBuildSearch::SearchOptions options;
+        if (!MHWIBuildSearch::parse_search_options(argc - 2, argv + 2, options)) {
+            std::cerr << "Invalid command arguments." << std::endl;
+            return 1;
+        }
+        MHWIBuildSearch::serve_cmd(options);
     } else if (argc == 1) {
         MHWIBuildSearch::no_args_cmd();
     } else {
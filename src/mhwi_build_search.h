@@ -33,6 +33,7 @@ struct SearchParameters {
 
 
 SearchParameters read_file(const std::string& filepath);
+SearchParameters read_json_str(const std::string& json_str);
 
 
 /****************************************************************************************
@@ -40,7 +41,47 @@ SearchParameters read_file(const std::string& filepath);
  ***************************************************************************************/
 
 
-void search_cmd(const std::string& search_parameters_path);
+// Options that control how a search is carried out, but not what is being searched for.
+// (What is being searched for is specified by SearchParameters.)
+struct SearchOptions {
+    // 1 runs the search on the calling thread. (Logging may use another thread.)
+    //
+    // Armour combo merges only use more threads if the combining seen set's tree is small enough for a
+    // concurrent seen map. (Trees of more than 2^36 bits aren't. A search logs when this happens.)
+    unsigned int num_threads {1};
+
+    unsigned int num_results      {1};     // Number of best builds to report.
+    bool         distinct_weapons {false}; // If true, no two reported builds share the same weapon.
+
+    // Approximate limit on memory used by the final armour combo merge, in MiB. Zero means no limit.
+    // If the final merge could exceed it, the merge is done in chunks, each of which is evaluated
+    // against weapons and then discarded.
+    //
+    // Combos of earlier chunks are evaluated before later chunks could replace them, so lower-ranked
+    // results could differ from an unbudgeted search. A memory budget therefore requires num_results == 1.
+    std::size_t memory_budget_mib {0};
+
+    // If true, the complete armour combos are kept, and later searches that only differ in the damage model,
+    // buffs, or weapon filters evaluate weapons against them instead of merging them again. This is only
+    // useful for serve_cmd().
+    bool reuse_armour_combos {false};
+
+    // If not empty, results are appended to this file as JSON lines, one build per line. Each line has an
+    // "event" of "result" (with a "rank") for the reported builds. If the search is single-threaded, new best
+    // builds are also written as they're found, with an "event" of "new_best".
+    std::string results_jsonl_path;
+};
+
+
+void search_cmd(const std::string& search_parameters_path, const SearchOptions& options);
+
+// Loads the database once, then runs a search for each line read from stdin.
+// Each line must be a search parameters JSON object, in the same format as search_cmd() reads from a file.
+//
+// Results for each search are written to stdout, followed by a line containing only "END". If a search
+// couldn't be carried out, a line starting with "ERROR " is written in place of the results.
+// Logs continue to be written to stderr.
+void serve_cmd(const SearchOptions& options);
 
 
 } // namespace
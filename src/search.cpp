@@ -7,9 +7,22 @@
 #include <assert.h>
 #include <chrono>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
 #include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <iostream>
+#include <optional>
+#include <set>
+#include <thread>
 #include <tuple>
+#include <type_traits>
 
 #include "mhwi_build_search.h"
 #include "core/core.h"
@@ -19,10 +32,12 @@
 #include "utils/utils.h"
 #include "utils/utils_strings.h"
 #include "utils/logging.h"
-#include "utils/pruning_vector.h"
+#include "utils/pareto_index.h"
 #include "utils/counter.h"
 #include "utils/counter_subset_seen_map.h"
 
+#include "../dependencies/json-3-7-3/json.hpp"
+
 
 namespace MHWIBuildSearch
 {
@@ -31,41 +46,177 @@ namespace MHWIBuildSearch
 using DecoSlots = std::vector<unsigned int>;
 
 
-struct SSBLimits {
-    unsigned int operator()(const Skill * const k) const noexcept {
-        return k->secret_limit;
-    }
-    unsigned int operator()(const SetBonus * const k) const noexcept {
-        return k->highest_stage;
+// Number of partial armour combos kept after each merge while looking for an incumbent.
+// (See find_incumbent_threshold().)
+static constexpr std::size_t k_INCUMBENT_BEAM_WIDTH = 64;
+
+
+struct PackedFieldLimits {
+    unsigned int operator()(const PackedSkills::Field& f) const noexcept {
+        return f.limit;
     }
 };
 
 
 using SSBTuple = std::tuple<SkillMap, SetBonusMap>;
 
+// Skills and set bonuses, packed according to the search's SkillLayout.
+using PackedSSBTuple = std::tuple<PackedSkills>;
+
 
 template<class StoredData>
 using SSBSeenMapSmall = Utils::NaiveCounterSubsetSeenMap<StoredData, SkillMap, SetBonusMap>;
 template<class StoredData>
-using SSBSeenMap = Utils::BitTreeCounterSubsetSeenMap<StoredData, SSBLimits, SkillMap, SetBonusMap>;
+using SSBSeenMap = Utils::BasicBitTreeCounterSubsetSeenMap<StoredData, PackedFieldLimits, Utils::AdaptiveSeenTree, PackedSkills>;
+template<class StoredData>
+using SSBConcurrentSeenMap = Utils::ConcurrentBitTreeCounterSubsetSeenMap<StoredData, PackedFieldLimits, Utils::AdaptiveSeenTree, PackedSkills>;
 
 template<class StoredData>
 using SkillsSeenMapSmall = Utils::NaiveCounterSubsetSeenMap<StoredData, SkillMap>;
 
 
+// Interns deco combos (multisets of decorations), handing out small integer IDs.
+//
+// The same deco combos recur for every armour piece with the same deco slots, in every armour slot, so
+// each one is only stored once, along with the skills it contributes.
+class DecoComboTable {
+public:
+    using ID = std::uint32_t;
+private:
+    struct Entry {
+        std::vector<const Decoration*> decos;
+        SkillMap                       skills; // Only skills in the skill spec's subset.
+        PackedSkills                   packed;
+    };
+
+    const SkillSpec& skill_spec;
+
+    std::vector<Entry>                           entries; // Indexed by ID.
+    std::map<std::vector<const Decoration*>, ID> ids;     // Keys are sorted.
+public:
+    explicit DecoComboTable(const SkillSpec& new_skill_spec) noexcept
+        : skill_spec (new_skill_spec)
+        , entries    {}
+        , ids        {}
+    {
+    }
+
+    // packed must be the skills contributed by decos, packed according to the search's SkillLayout.
+    ID intern(const std::vector<const Decoration*>& decos, const PackedSkills& packed) {
+        std::vector<const Decoration*> k = decos;
+        std::sort(k.begin(), k.end());
+        const auto result = this->ids.find(k);
+        if (result != this->ids.end()) {
+            assert(this->entries[result->second].packed == packed);
+            return result->second;
+        }
+
+        assert(this->entries.size() < std::numeric_limits<ID>::max());
+        const ID id = this->entries.size();
+        SkillMap skills;
+        skills.add_skills_filtered(decos, this->skill_spec);
+        this->entries.push_back({decos, std::move(skills), packed});
+        this->ids.emplace(std::move(k), id);
+        return id;
+    }
+
+    const std::vector<const Decoration*>& get_decos(const ID id) const noexcept {
+        return this->entries[id].decos;
+    }
+
+    const SkillMap& get_skills(const ID id) const noexcept {
+        return this->entries[id].skills;
+    }
+
+    const PackedSkills& get_packed(const ID id) const noexcept {
+        return this->entries[id].packed;
+    }
+
+    std::size_t size() const noexcept {
+        return this->entries.size();
+    }
+};
+
+
 struct ArmourPieceCombo {
     const ArmourPiece* armour_piece;
-    DecoEquips decos;
+    DecoComboTable::ID decos;
 
     const SetBonus* setbonus;
+
+    PackedSkills packed_ssb; // Skills from the piece and decos, and the piece's set bonus.
+};
+
+
+// Number of armour pieces per set bonus, for up to one piece per armour slot.
+// A compact alternative to SetBonusMap that needs no allocations.
+class SetBonusPieceCounts {
+    static constexpr std::size_t k_MAX_SET_BONUSES = 5; // At most one per armour piece.
+
+    std::array<const SetBonus*, k_MAX_SET_BONUSES> set_bonuses {}; // Unused entries are null.
+    std::array<unsigned char, k_MAX_SET_BONUSES>   counts      {};
+public:
+    unsigned int get(const SetBonus * const set_bonus) const noexcept {
+        for (std::size_t i = 0; i < k_MAX_SET_BONUSES; ++i) {
+            if (this->set_bonuses[i] == set_bonus) return this->counts[i];
+        }
+        return 0;
+    }
+
+    void increment(const SetBonus * const set_bonus) noexcept {
+        assert(set_bonus);
+        for (std::size_t i = 0; i < k_MAX_SET_BONUSES; ++i) {
+            if ((this->set_bonuses[i] == set_bonus) || !this->set_bonuses[i]) {
+                this->set_bonuses[i] = set_bonus;
+                ++this->counts[i];
+                return;
+            }
+        }
+        assert(false); // More pieces were added than there are armour slots.
+    }
+
+    SetBonusMap as_set_bonus_map() const {
+        SetBonusMap ret;
+        for (std::size_t i = 0; i < k_MAX_SET_BONUSES; ++i) {
+            if (this->set_bonuses[i]) ret.set(this->set_bonuses[i], this->counts[i]);
+        }
+        return ret;
+    }
 };
 
 
+// Armour combos are held by the millions, so they're kept trivially copyable. Decorations are found through
+// the piece combos they were built from, which live in the slot lists for the rest of the search.
 struct ArmourSetCombo {
+    static constexpr std::size_t k_NUM_PIECE_COMBOS = 5;
+
     ArmourEquips armour;
-    DecoEquips decos;
 
-    SetBonusMap unfiltered_setbonuses;
+    // In merge order. (See plan_merge_order().) Null if not yet merged in.
+    std::array<const ArmourPieceCombo*, k_NUM_PIECE_COMBOS> piece_combos;
+
+    SetBonusPieceCounts unfiltered_setbonuses;
+
+    DecoEquips get_decos(const DecoComboTable& deco_table) const {
+        std::vector<const Decoration*> ret;
+        for (const ArmourPieceCombo * const piece_combo : this->piece_combos) {
+            if (!piece_combo) continue;
+            const std::vector<const Decoration*>& decos = deco_table.get_decos(piece_combo->decos);
+            ret.insert(ret.end(), decos.begin(), decos.end());
+        }
+        return DecoEquips(std::move(ret));
+    }
+};
+static_assert(std::is_trivially_copyable<ArmourSetCombo>::value);
+
+
+// An armour combo as moved out of a combining seen set.
+using ArmourComboEntry = std::pair<PackedSSBTuple, ArmourSetCombo>;
+
+// Refers to an armour combo held elsewhere, e.g. by a combining seen set or a Generation moved out of one.
+struct ArmourComboRef {
+    const PackedSSBTuple* ssb;
+    const ArmourSetCombo* combo;
 };
 
 
@@ -76,6 +227,28 @@ struct WeaponInstanceExtended {
 };
 
 
+// The WeaponBatch holds the same weapons as the vector, in the same order.
+using WeaponGroups = std::vector<std::tuple<DecoSlots,
+                                            const Skill*,
+                                            const SetBonus*,
+                                            std::vector<WeaponInstanceExtended>,
+                                            WeaponBatch>>;
+
+
+// A complete build found by the final stage of the search, kept around so it can be reported.
+struct FoundBuild {
+    double                 total_damage;
+    std::size_t            armour_combo_index; // Position of the armour combo in iteration order.
+                                               // Ties in total damage are broken by the lowest index.
+    WeaponInstanceExtended weapon;
+    ArmourSetCombo         armour_combo; // Copied, since armour combos may be discarded before reporting.
+    DecoEquips             decos; // Includes the decos in the armour combo.
+    SkillMap               skills;
+    EffectiveDamageValues  edv;
+    ModelCalculatedValues  mcv;
+};
+
+
 
 struct WeaponInstancePruneFn {
     // Return true if left can prune away right.
@@ -178,19 +351,91 @@ struct WeaponInstancePruneFn {
 };
 
 
-static std::vector<WeaponInstanceExtended> prepare_weapons(const Database& db,
-                                                           const SearchParameters& params,
-                                                           const std::unordered_map<const SetBonus*,
-                                                                                    unsigned int>& set_bonus_subset) {
+// Index for WeaponInstancePruneFn.
+//
+// Weapons are partitioned by everything that WeaponInstancePruneFn compares for equality, or compares
+// as a flag. partition_can_replace() repeats those parts of WeaponInstancePruneFn.
+// The key sums everything that WeaponInstancePruneFn requires left to have at least as much of.
+struct WeaponInstanceIndexFn {
+    using T = std::pair<WeaponInstance, WeaponContribution>;
+
+    using Partition = std::tuple<DecoSlots,
+                                 const Skill*,
+                                 const SetBonus*,
+                                 EleStatVisibility,
+                                 EleStatType,
+                                 bool,           // Has an element/status value.
+                                 bool,           // Health regen is active.
+                                 bool >;         // Is constant sharpness.
+
+    Partition partition(const T& x) const {
+        const WeaponContribution& c = x.second;
+        return {c.deco_slots,
+                c.skill,
+                c.set_bonus,
+                c.elestat_visibility,
+                c.elestat_type,
+                (c.elestat_value != 0),
+                c.health_regen_active,
+                c.is_constant_sharpness };
+    }
 
-    auto start_t = std::chrono::steady_clock::now();
+    bool partition_can_replace(const Partition& left, const Partition& right) const noexcept {
+        const auto& [l_slots, l_skill, l_sb, l_vis, l_type, l_has_value, l_regen, l_const] = left;
+        const auto& [r_slots, r_skill, r_sb, r_vis, r_type, r_has_value, r_regen, r_const] = right;
 
-    std::vector<const Weapon*> weapons = db.weapons.get_all_of_weaponclass(params.weapon_class);
-    Utils::log_stat("Weapons: ", weapons.size());
-    assert(weapons.size());
+        if ((r_vis == EleStatVisibility::open) && (l_vis != EleStatVisibility::open)) return false;
+        if ((r_vis == EleStatVisibility::hidden) && (l_vis == EleStatVisibility::none)) return false;
+        if (r_has_value && ((!l_has_value) || (l_type != r_type))) return false;
 
-    std::vector<std::pair<WeaponInstance, WeaponContribution>> unpruned;
+        if (l_slots.size() < r_slots.size()) return false;
+        for (std::size_t i = 0; i < r_slots.size(); ++i) {
+            if (l_slots[i] < r_slots[i]) return false;
+        }
+
+        if ((r_sb && (l_sb != r_sb)) || (r_skill && (l_skill != r_skill))) return false;
+        if (r_regen && !l_regen) return false;
+        if ((!l_const) && r_const) return false;
+        return true;
+    }
+
+    double key(const T& x) const noexcept {
+        const WeaponContribution& c = x.second;
+        double ret = c.weapon_raw + c.weapon_aff + c.elestat_value;
+        for (const unsigned int v : c.deco_slots) {
+            ret += v;
+        }
+        return ret;
+    }
+};
+
+
+struct ArmourStage;
+
+
+// Search data kept for reuse across searches. (See serve_cmd().) Must not outlive the database it was
+// generated from.
+struct SearchCache {
+    // Every augment+upgrade instance of every weapon of a weapon class, before any filtering.
+    std::map<WeaponClass, std::vector<std::pair<WeaponInstance, WeaponContribution>>> weapon_instances;
+
+    // Complete armour combos of the most recent search, if SearchOptions::reuse_armour_combos is set.
+    // Unlike the weapon instances, these depend on the search parameters. (See ArmourStage::Key.)
+    std::unique_ptr<ArmourStage> armour_stage;
+};
 
+
+static const std::vector<std::pair<WeaponInstance, WeaponContribution>>& generate_weapon_instances(const Database& db,
+                                                                                                  const WeaponClass weapon_class,
+                                                                                                  SearchCache& cache) {
+    const auto result = cache.weapon_instances.find(weapon_class);
+    if (result != cache.weapon_instances.end()) return result->second;
+
+    std::vector<const Weapon*> weapons = db.weapons.get_all_of_weaponclass(weapon_class);
+    Utils::log_stat("Weapons: ", weapons.size());
+    if (!weapons.size()) throw std::runtime_error("There are no weapons of the weapon class.");
+
+    std::vector<std::pair<WeaponInstance, WeaponContribution>> ret;
     for (const Weapon * const weapon : weapons) {
         const auto augment_instances = WeaponAugmentsInstance::generate_maximized_instances(weapon);
         const auto upgrade_instances = WeaponUpgradesInstance::generate_maximized_instances(weapon);
@@ -198,39 +443,59 @@ static std::vector<WeaponInstanceExtended> prepare_weapons(const Database& db,
             for (const std::shared_ptr<WeaponUpgradesInstance>& u : upgrade_instances) {
                 WeaponInstance new_inst = {weapon, a, u};
                 WeaponContribution new_cont = new_inst.calculate_contribution();
+                ret.emplace_back(std::move(new_inst), std::move(new_cont));
+            }
+        }
+    }
+    return cache.weapon_instances.emplace(weapon_class, std::move(ret)).first->second;
+}
 
-                // Filter
 
-                if (params.skill_spec.skill_must_be_removed(new_cont.skill)) {
-                    continue;
-                }
-                if (params.health_regen_required && !new_cont.health_regen_active) {
-                    continue;
-                }
+static std::vector<WeaponInstanceExtended> prepare_weapons(const Database& db,
+                                                           const SearchParameters& params,
+                                                           const std::unordered_map<const SetBonus*,
+                                                                                    unsigned int>& set_bonus_subset,
+                                                           SearchCache& cache) {
+
+    auto start_t = std::chrono::steady_clock::now();
 
-                // Reprocess
+    std::vector<std::pair<WeaponInstance, WeaponContribution>> unpruned;
 
-                if (!Utils::set_has_key(params.allowed_weapon_elestat_types, new_cont.elestat_type)) {
-                    assert(new_cont.elestat_value);
-                    new_cont.erase_elestat();
-                }
-                if (!Utils::map_has_key(set_bonus_subset, new_cont.set_bonus)) {
-                    new_cont.set_bonus = nullptr;
-                }
-                if (!params.skill_spec.is_in_subset(new_cont.skill)) {
-                    new_cont.skill = nullptr;
-                }
+    for (const auto& e : generate_weapon_instances(db, params.weapon_class, cache)) {
+        WeaponContribution new_cont = e.second;
 
-                unpruned.emplace_back(std::move(new_inst), std::move(new_cont));
-            }
+        // Filter
+
+        if (params.skill_spec.skill_must_be_removed(new_cont.skill)) {
+            continue;
         }
+        if (params.health_regen_required && !new_cont.health_regen_active) {
+            continue;
+        }
+
+        // Reprocess
+
+        if (!Utils::set_has_key(params.allowed_weapon_elestat_types, new_cont.elestat_type)) {
+            assert(new_cont.elestat_value);
+            new_cont.erase_elestat();
+        }
+        if (!Utils::map_has_key(set_bonus_subset, new_cont.set_bonus)) {
+            new_cont.set_bonus = nullptr;
+        }
+        if (!params.skill_spec.is_in_subset(new_cont.skill)) {
+            new_cont.skill = nullptr;
+        }
+
+        unpruned.emplace_back(e.first, std::move(new_cont));
     }
     const std::size_t stat_pre = unpruned.size();
 
     Utils::log_stat_duration("  >>> weapon augment+upgrade instance generation: ", start_t);
     start_t = std::chrono::steady_clock::now();
 
-    Utils::PruningVector<std::pair<WeaponInstance, WeaponContribution>, WeaponInstancePruneFn> pruned;
+    Utils::ParetoIndex<std::pair<WeaponInstance, WeaponContribution>,
+                       WeaponInstancePruneFn,
+                       WeaponInstanceIndexFn> pruned;
 
     //std::size_t i = 0;
     for (auto& e : unpruned) {
@@ -263,9 +528,20 @@ static std::vector<WeaponInstanceExtended> prepare_weapons(const Database& db,
 }
 
 
+// weapons must not be empty.
+static WeaponBatch make_weapon_batch(const std::vector<WeaponInstanceExtended>& weapons) {
+    assert(weapons.size());
+    WeaponBatch ret (weapons.front().instance.weapon->weapon_class);
+    for (const WeaponInstanceExtended& wc : weapons) {
+        assert(wc.instance.weapon->weapon_class == weapons.front().instance.weapon->weapon_class);
+        ret.push_back(wc.contributions);
+    }
+    return ret;
+}
+
+
 // TODO: Ugh, fix this style. Actually, fix the entire codebase's style. eww.
-static std::vector<std::tuple<DecoSlots, const Skill*, const SetBonus*, std::vector<WeaponInstanceExtended>>>
-group_weapons(std::vector<WeaponInstanceExtended>&& weapons) {
+static WeaponGroups group_weapons(std::vector<WeaponInstanceExtended>&& weapons) {
     std::map<std::tuple<DecoSlots, const Skill*, const SetBonus*>, std::vector<WeaponInstanceExtended>> groups;
 
     for (auto& wc : weapons) {
@@ -277,12 +553,14 @@ group_weapons(std::vector<WeaponInstanceExtended>&& weapons) {
         group.emplace_back(std::move(wc));
     }
 
-    std::vector<std::tuple<DecoSlots, const Skill*, const SetBonus*, std::vector<WeaponInstanceExtended>>> ret;
+    WeaponGroups ret;
     for (auto& e : groups) {
+        WeaponBatch batch = make_weapon_batch(e.second);
         ret.emplace_back(std::get<0>(e.first),
                          std::get<1>(e.first),
                          std::get<2>(e.first),
-                         std::move(e.second) );
+                         std::move(e.second),
+                         std::move(batch) );
     }
     return ret;
 }
@@ -436,11 +714,16 @@ static std::map<ArmourSlot, std::vector<const ArmourPiece*>> prepare_armour(cons
 }
 
 
-static std::vector<std::vector<const Decoration*>> generate_deco_combos(const DecoSlots& deco_slots,
-                                                                        const std::array<std::vector<const Decoration*>,
-                                                                                         k_MAX_DECO_SIZE>& sorted_decos,
-                                                                        const SkillSpec& skill_spec,
-                                                                        const SkillMap& existing_skills) {
+// A combination of decorations, and the skills they contribute (packed, and within the layout).
+using DecoCombo = std::pair<std::vector<const Decoration*>, PackedSkills>;
+
+
+// existing_skills is only used to stop adding decorations once their skills reach their limits.
+static std::vector<DecoCombo> generate_deco_combos(const DecoSlots& deco_slots,
+                                                   const std::array<std::vector<const Decoration*>,
+                                                                    k_MAX_DECO_SIZE>& sorted_decos,
+                                                   const SkillLayout& layout,
+                                                   const PackedSkills& existing_skills) {
     assert(std::is_sorted(deco_slots.begin(), deco_slots.end(), std::greater<unsigned int>()));
 
     if (!deco_slots.size()) return {};
@@ -449,10 +732,9 @@ static std::vector<std::vector<const Decoration*>> generate_deco_combos(const De
     // We will "consume" deco slots from deco_slots by tracking the first "unconsumed" slot.
     using DecoSlotsHead = DecoSlots::const_iterator;
 
-    using WorkingCombo  = std::pair<std::vector<const Decoration*>, DecoSlotsHead>;
+    using WorkingCombo  = std::pair<DecoCombo, DecoSlotsHead>;
     using WorkingList   = std::vector<WorkingCombo>;
-    using CompleteCombo = std::vector<const Decoration*>;
-    using CompleteList  = std::vector<CompleteCombo>;
+    using CompleteList  = std::vector<DecoCombo>;
 
     WorkingList incomplete_combos = {{{}, deco_slots.begin()}}; // Start with a seed combo
     CompleteList complete_combos;
@@ -468,23 +750,27 @@ static std::vector<std::vector<const Decoration*>> generate_deco_combos(const De
 
         unsigned int max_to_add = 0;
         for (const auto& e : deco->skills) {
-            if (skill_spec.is_in_subset(e.first)) {
-                assert(e.first->secret_limit >= existing_skills.get(e.first));
-                const unsigned int v = Utils::ceil_div(e.first->secret_limit - existing_skills.get(e.first), e.second);
+            if (layout.contains(e.first)) {
+                const unsigned int existing_lvl = existing_skills.get(layout.field(e.first));
+                assert(e.first->secret_limit >= existing_lvl);
+                const unsigned int v = Utils::ceil_div(e.first->secret_limit - existing_lvl, e.second);
                 if (v > max_to_add) max_to_add = v;
             }
         }
 
-        for (WorkingCombo combo : incomplete_combos) {
+        const PackedSkills deco_skills = layout.pack(*deco);
+
+        for (const WorkingCombo& combo : incomplete_combos) {
             assert(combo.second != deco_slots.end());
 
             // We skip 0 because we already copied all previous combos.
-            std::vector<const Decoration*> curr_decos = combo.first;
+            DecoCombo curr_decos = combo.first;
             DecoSlotsHead curr_head = combo.second;
             for (unsigned int to_add = 1; to_add <= max_to_add; ++to_add) {
                 if (*curr_head < deco->slot_size) break; // Stop adding. Deco can no longer fit.
 
-                curr_decos.emplace_back(deco);
+                curr_decos.first.emplace_back(deco);
+                curr_decos.second.merge_in(deco_skills, layout);
                 ++curr_head;
 
                 if (curr_head == deco_slots.end()) {
@@ -508,12 +794,139 @@ static std::vector<std::vector<const Decoration*>> generate_deco_combos(const De
 }
 
 
+struct PackedSkillsHash {
+    std::size_t operator()(const PackedSkills& x) const noexcept {
+        return x.calculate_hash();
+    }
+};
+
+
+// Memoizes generate_deco_combos().
+//
+// The combinations only depend on the deco slots, and on how many more levels of each skill can be
+// added before reaching its limit. Headroom is clipped to what the slots could possibly fill, so many
+// different sets of existing skills share the same cached combinations.
+//
+// Not thread-safe. Each thread should have its own cache.
+class DecoComboCache {
+    using SortedDecos = std::array<std::vector<const Decoration*>, k_MAX_DECO_SIZE>;
+
+    struct SlotsEntry {
+        // Each skill that decos can add, and the lowest existing level that still needs to be told apart.
+        // (Anything lower leaves more headroom than the slots can fill.)
+        std::vector<std::pair<PackedSkills::Field, unsigned int>> floors;
+
+        // The highest level of each skill that any deco combo for the slots can add.
+        PackedSkills fill;
+
+        std::unordered_map<PackedSkills, std::vector<DecoCombo>, PackedSkillsHash> combos;
+    };
+
+    const SortedDecos& sorted_decos;
+    const SkillLayout& layout;
+
+    std::map<DecoSlots, SlotsEntry> entries;
+
+    std::size_t stat_hits;
+    std::size_t stat_misses;
+public:
+    DecoComboCache(const SortedDecos& new_sorted_decos, const SkillLayout& new_layout) noexcept
+        : sorted_decos (new_sorted_decos)
+        , layout       (new_layout)
+        , entries      {}
+        , stat_hits    {0}
+        , stat_misses  {0}
+    {
+    }
+
+    // Same as generate_deco_combos(). The reference remains valid for as long as the cache exists.
+    const std::vector<DecoCombo>& get(const DecoSlots& deco_slots, const PackedSkills& existing_skills) {
+        SlotsEntry& entry = this->get_slots_entry(deco_slots);
+
+        PackedSkills k;
+        for (const auto& e : entry.floors) {
+            k.set_or_remove(e.first, std::max(existing_skills.get(e.first), e.second));
+        }
+
+        const auto result = entry.combos.find(k);
+        if (result != entry.combos.end()) {
+            ++this->stat_hits;
+            return result->second;
+        }
+        ++this->stat_misses;
+        std::vector<DecoCombo> combos = generate_deco_combos(deco_slots, this->sorted_decos, this->layout, k);
+        assert(combos == generate_deco_combos(deco_slots, this->sorted_decos, this->layout, existing_skills));
+        return entry.combos.emplace(k, std::move(combos)).first->second;
+    }
+
+    // Returns skills that dominate what any of get(deco_slots, ...) can add, regardless of existing skills.
+    const PackedSkills& get_fill(const DecoSlots& deco_slots) {
+        return this->get_slots_entry(deco_slots).fill;
+    }
+
+    // Returns a copy of the cache contents, but with its stats reset.
+    // Useful for giving each thread its own already-warm cache.
+    DecoComboCache fork() const {
+        DecoComboCache ret = *this;
+        ret.stat_hits = 0;
+        ret.stat_misses = 0;
+        return ret;
+    }
+
+    void add_stats(const DecoComboCache& other) noexcept {
+        this->stat_hits += other.stat_hits;
+        this->stat_misses += other.stat_misses;
+    }
+
+    std::size_t get_stat_hits() const noexcept {
+        return this->stat_hits;
+    }
+
+    std::size_t get_stat_misses() const noexcept {
+        return this->stat_misses;
+    }
+
+private:
+    SlotsEntry& get_slots_entry(const DecoSlots& deco_slots) {
+        const auto result = this->entries.find(deco_slots);
+        if (result != this->entries.end()) return result->second;
+
+        SlotsEntry entry;
+        if (deco_slots.size()) {
+            // generate_deco_combos() adds at most one deco per slot, so a headroom of
+            // (slots * highest level per deco) is enough to never be the limiting factor.
+            std::map<const Skill*, unsigned int> max_per_deco;
+            for (const Decoration * const deco : this->sorted_decos[deco_slots.front() - 1]) {
+                for (const auto& e : deco->skills) {
+                    if (!this->layout.contains(e.first)) continue;
+                    unsigned int& v = max_per_deco[e.first];
+                    v = std::max(v, e.second);
+                }
+            }
+            for (const auto& e : max_per_deco) {
+                const unsigned int max_headroom = deco_slots.size() * e.second;
+                const unsigned int limit = e.first->secret_limit;
+                const unsigned int floor = (limit > max_headroom) ? (limit - max_headroom) : 0;
+                entry.floors.emplace_back(this->layout.field(e.first), floor);
+            }
+
+            // Existing skills only ever stop decos from being added, so no existing skills gives the most.
+            for (const DecoCombo& deco_combo : generate_deco_combos(deco_slots, this->sorted_decos, this->layout, {})) {
+                entry.fill = this->layout.field_max(entry.fill, deco_combo.second);
+            }
+        }
+        return this->entries.emplace(deco_slots, std::move(entry)).first->second;
+    }
+};
+
+
 static SSBSeenMapSmall<ArmourPieceCombo> generate_slot_combos(const std::vector<const ArmourPiece*>& pieces,
-                                                              const std::array<std::vector<const Decoration*>,
-                                                                               k_MAX_DECO_SIZE>& sorted_decos,
+                                                              DecoComboCache& deco_cache,
+                                                              DecoComboTable& deco_table,
                                                               const SkillSpec& skill_spec,
                                                               const std::unordered_map<const SetBonus*,
                                                                                        unsigned int>& set_bonus_subset,
+                                                              const SkillLayout& layout,
                                                               const std::string& debug_msg) {
     // We will assume decorations are sorted.
     // TODO: Add a runtime assert.
@@ -526,28 +939,31 @@ static SSBSeenMapSmall<ArmourPieceCombo> generate_slot_combos(const std::vector<
 
         SkillMap armour_skills;
         armour_skills.add_skills_filtered(*piece, skill_spec);
+        const PackedSkills armour_packed = layout.pack(armour_skills);
 
-        std::vector<std::vector<const Decoration*>> deco_combos = generate_deco_combos(piece->deco_slots,
-                                                                                       sorted_decos,
-                                                                                       skill_spec,
-                                                                                       armour_skills);
+        const std::vector<DecoCombo>& deco_combos = deco_cache.get(piece->deco_slots, armour_packed);
 
         stat_pre += deco_combos.size(); // TODO: How do I know this won't overflow?
 
-        for (std::vector<const Decoration*>& decos : deco_combos) {
+        for (const DecoCombo& deco_combo : deco_combos) {
+            const DecoComboTable::ID decos = deco_table.intern(deco_combo.first, deco_combo.second);
 
             SSBTuple ssb = {armour_skills, {}};
+            PackedSkills packed_ssb = armour_packed;
 
-            std::get<0>(ssb).add_skills_filtered(decos, skill_spec);
+            std::get<0>(ssb).merge_in(deco_table.get_skills(decos));
+            packed_ssb.merge_in(deco_table.get_packed(decos), layout);
             const SetBonus* setbonus;
             if (Utils::map_has_key(set_bonus_subset, piece->set_bonus)) {
                 std::get<1>(ssb).set(piece->set_bonus, 1);
+                packed_ssb.set(layout.field(piece->set_bonus), 1);
                 setbonus = piece->set_bonus;
             } else {
                 setbonus = nullptr;
             }
+            assert(packed_ssb == layout.pack(std::get<0>(ssb), std::get<1>(ssb)));
 
-            seen_set.add({piece, std::move(decos), setbonus}, std::move(ssb));
+            seen_set.add({piece, decos, setbonus, packed_ssb}, std::move(ssb));
         }
     }
 
@@ -585,17 +1001,25 @@ static std::vector<const Skill*> get_skills_in_subset_servable_without_sb_or_wea
 
 static void merge_in_charms(SSBSeenMap<ArmourSetCombo>& armour_combos,
                             const std::vector<const Charm*>& charms,
-                            const SkillSpec& skill_spec) {
-    auto prev_armour_combos = armour_combos.get_data_as_vector();
+                            const SkillSpec& skill_spec,
+                            const SkillLayout& layout) {
+    auto prev_armour_combos = armour_combos.take_generation();
+
+    std::vector<PackedSkills> charms_packed;
+    for (const Charm * const charm : charms) {
+        SkillMap x;
+        x.add_skills_filtered(*charm, charm->max_charm_lvl, skill_spec);
+        charms_packed.emplace_back(layout.pack(x));
+    }
 
     for (const auto& e1 : prev_armour_combos) {
-        const SSBTuple&       set_combo_ssb = e1.first;
-        const ArmourSetCombo& set_combo     = e1.second;
+        const PackedSSBTuple& set_combo_ssb = e1.key();
+        const ArmourSetCombo& set_combo     = e1.mapped();
 
-        assert(std::get<0>(set_combo_ssb).only_contains_skills_in_spec(skill_spec));(void)skill_spec;
         assert(!set_combo.armour.charm_slot_is_filled());
 
-        for (const Charm * const charm : charms) {
+        for (std::size_t i = 0; i < charms.size(); ++i) {
+            const Charm * const charm = charms[i];
 
             const auto op1 = [&](){
                 ArmourSetCombo x = set_combo;
@@ -604,224 +1028,1201 @@ static void merge_in_charms(SSBSeenMap<ArmourSetCombo>& armour_combos,
             };
 
             const auto op2 = [&](){
-                SSBTuple x = set_combo_ssb;
-                std::get<0>(x).add_skills_filtered(*charm, charm->max_charm_lvl, skill_spec);
+                PackedSSBTuple x = set_combo_ssb;
+                std::get<0>(x).merge_in(charms_packed[i], layout);
                 return x;
             };
-            
+
             armour_combos.add_using_callback(op1, op2());
         }
     }
+
+    armour_combos.restore_generation(std::move(prev_armour_combos));
+}
+
+
+// Merges prev_armour_combos with piece_combos, adding the results to armour_combos.
+//
+// If num_threads is greater than 1, the threads take chunks of the previous armour combos and all add
+// to one concurrent seen map, so anything dominated by a combo from any thread can be rejected early.
+// Each combo's position in the serial iteration order is used as its priority, so the resulting set of
+// combos is the same as the serial merge.
+//
+// If the combining seen set's tree is too large for a concurrent seen map (see can_hold()), the merge runs on
+// the calling thread instead.
+static void merge_armour_list_into(SSBSeenMap<ArmourSetCombo>& armour_combos,
+                                   const std::vector<ArmourComboRef>& prev_armour_combos,
+                                   const SSBSeenMapSmall<ArmourPieceCombo>& piece_combos,
+                                   const SkillSpec& skill_spec,
+                                   const SkillLayout& layout,
+                                   const std::size_t stage,
+                                   const unsigned int num_threads) {
+    // add_fn(op1, PackedSSBTuple&&, std::size_t priority) adds a combo to the destination map.
+    const auto merge_range = [&](const auto& add_fn,
+                                 const std::size_t lo,
+                                 const std::size_t hi){
+        for (std::size_t i = lo; i < hi; ++i) {
+            const PackedSSBTuple& set_combo_ssb = *prev_armour_combos[i].ssb;
+            const ArmourSetCombo& set_combo     = *prev_armour_combos[i].combo;
+
+            std::size_t priority = i * piece_combos.size();
+            for (const auto& e2 : piece_combos) {
+                const ArmourPieceCombo& piece_combo = e2.second;
+                ++priority;
+
+                const SetBonusPieceCounts unfiltered_setbonuses = [&](){
+                    SetBonusPieceCounts x = set_combo.unfiltered_setbonuses;
+                    if (piece_combo.armour_piece->set_bonus) {
+                        x.increment(piece_combo.armour_piece->set_bonus);
+                    }
+                    return x;
+                }();
+
+                // We first need to check if the set bonuses exceed our limits.
+                bool skip = false;
+                for (const auto& e : skill_spec.get_set_bonus_cutoffs()) {
+                    if (unfiltered_setbonuses.get(e.first) >= e.second) {
+                        skip = true;
+                        break;
+                    }
+                }
+                if (skip) {
+                    continue;
+                }
+
+                // Now, we may continue to add it!
+
+                const auto op1 = [&](){
+                    ArmourSetCombo x = set_combo;
+                    x.armour.add(piece_combo.armour_piece);
+                    assert(!x.piece_combos[stage]);
+                    x.piece_combos[stage] = &piece_combo;
+                    x.unfiltered_setbonuses = unfiltered_setbonuses;
+                    assert(x.unfiltered_setbonuses.as_set_bonus_map() == x.armour.get_set_bonuses());
+                    return x;
+                };
+
+                // Set bonus pieces are clipped to the highest number of pieces worth counting.
+                const auto op2 = [&](){
+                    PackedSSBTuple x = set_combo_ssb;
+                    std::get<0>(x).merge_in(piece_combo.packed_ssb, layout);
+                    return x;
+                };
+
+                add_fn(op1, op2(), priority);
+            }
+        }
+    };
+
+    const bool concurrent = SSBConcurrentSeenMap<ArmourSetCombo>::can_hold(armour_combos);
+    const std::size_t num_workers = concurrent ? std::min<std::size_t>(num_threads, prev_armour_combos.size()) : 1;
+    if (num_workers <= 1) {
+        const auto add_fn = [&](const auto& op1, PackedSSBTuple&& k, const std::size_t){
+            armour_combos.add_using_callback(op1, std::move(k));
+        };
+        merge_range(add_fn, 0, prev_armour_combos.size());
+        return;
+    }
+
+    // Chunks are handed out dynamically since the work per previous combo varies a lot.
+    static constexpr std::size_t k_CHUNK_SIZE = 64;
+
+    SSBConcurrentSeenMap<ArmourSetCombo> concurrent_combos (armour_combos);
+    std::atomic<std::size_t> next_index {0};
+
+    const auto worker = [&](){
+        const auto add_fn = [&](const auto& op1, PackedSSBTuple&& k, const std::size_t priority){
+            concurrent_combos.add_using_callback(op1, std::move(k), priority);
+        };
+        for (;;) {
+            const std::size_t lo = next_index.fetch_add(k_CHUNK_SIZE);
+            if (lo >= prev_armour_combos.size()) break;
+            const std::size_t hi = std::min(lo + k_CHUNK_SIZE, prev_armour_combos.size());
+            merge_range(add_fn, lo, hi);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < num_workers; ++i) {
+        threads.emplace_back(worker);
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    std::move(concurrent_combos).drain_into(armour_combos);
 }
 
 
+// Merges piece_combos into armour_combos in place. (See merge_armour_list_into().)
 static void merge_in_armour_list(SSBSeenMap<ArmourSetCombo>& armour_combos,
                                  const SSBSeenMapSmall<ArmourPieceCombo>& piece_combos,
-                                 const std::unordered_map<const SetBonus*, unsigned int>& set_bonus_subset,
-                                 const SkillSpec& skill_spec) {
-    auto prev_armour_combos = armour_combos.get_data_as_vector();
+                                 const SkillSpec& skill_spec,
+                                 const SkillLayout& layout,
+                                 const std::size_t stage,
+                                 const unsigned int num_threads) {
+    auto prev_generation = armour_combos.take_generation();
+    std::vector<ArmourComboRef> prev_armour_combos;
+    prev_armour_combos.reserve(prev_generation.size());
+    for (const auto& e : prev_generation) {
+        prev_armour_combos.push_back({&e.key(), &e.mapped()});
+    }
 
-    for (const auto& e1 : prev_armour_combos) {
-        const SSBTuple&       set_combo_ssb = e1.first;
-        const ArmourSetCombo& set_combo     = e1.second;
+    merge_armour_list_into(armour_combos,
+                           prev_armour_combos,
+                           piece_combos,
+                           skill_spec,
+                           layout,
+                           stage,
+                           num_threads);
+    armour_combos.restore_generation(std::move(prev_generation));
+}
 
-        assert(std::get<0>(set_combo_ssb).only_contains_skills_in_spec(skill_spec));(void)skill_spec;
 
-        for (const auto& e2 : piece_combos) {
-            const SSBTuple&         piece_combo_ssb = e2.first;
-            const ArmourPieceCombo& piece_combo     = e2.second;
+// Rough size of an armour combo held by a combining seen set, including container overhead and the
+// decorations it owns.
+static constexpr std::size_t k_ESTIMATED_ARMOUR_COMBO_BYTES = sizeof(ArmourComboEntry) + 128;
 
-            SetBonusMap unfiltered_setbonuses = [&](){
-                SetBonusMap x = set_combo.unfiltered_setbonuses;
-                if (piece_combo.armour_piece->set_bonus) {
-                    x.increment(piece_combo.armour_piece->set_bonus, 1);
-                }
-                return x;
-            }();
 
-            // We first need to check if the set bonuses exceed our limits.
-            bool skip = false;
-            for (const auto& e : skill_spec.get_set_bonus_cutoffs()) {
-                if (unfiltered_setbonuses.get(e.first) >= e.second) {
-                    skip = true;
-                    break;
-                }
-            }
-            if (skip) {
-                continue;
-            }
+// Number of previous armour combos that can be merged with piece_combos at once while keeping the
+// combining seen sets within the memory budget, assuming that nothing gets pruned.
+//
+// Returns zero if the merge doesn't need to be split up.
+static std::size_t get_merge_chunk_size(const SSBSeenMap<ArmourSetCombo>& armour_combos,
+                                        const SSBSeenMapSmall<ArmourPieceCombo>& piece_combos,
+                                        const SearchOptions& options) {
+    if (!options.memory_budget_mib) return 0;
+    const std::size_t budget = options.memory_budget_mib * 1024 * 1024;
 
-            // Now, we may continue to add it!
+    // The previous combos and the seen trees are held regardless of how the merge is split up.
+    // (Only a dense tree's size is known in advance, but a paged tree is no bigger in the worst case.)
+    const std::size_t fixed = (armour_combos.size() * k_ESTIMATED_ARMOUR_COMBO_BYTES)
+                              + (2 * armour_combos.get_seen_tree().size() / 8);
+    const std::size_t per_prev_combo = (piece_combos.size() + 1) * k_ESTIMATED_ARMOUR_COMBO_BYTES;
 
-            const auto op1 = [&](){
-                ArmourSetCombo x = {set_combo.armour,
-                                    set_combo.decos,
-                                    std::move(unfiltered_setbonuses)};
-                x.armour.add(piece_combo.armour_piece);
-                x.decos.merge_in(piece_combo.decos);
-                assert(x.unfiltered_setbonuses == x.armour.get_set_bonuses());
-                return x;
-            };
+    if (armour_combos.size() * per_prev_combo <= budget - std::min(budget, fixed)) return 0;
+    return std::max<std::size_t>((budget - std::min(budget, fixed)) / per_prev_combo, 1);
+}
 
-            const auto op2 = [&](){
-                SSBTuple x = set_combo_ssb;
-                std::get<0>(x).merge_in(std::get<0>(piece_combo_ssb));
-                if (piece_combo.setbonus) {
-                    const unsigned int curr_setbonus_pieces = std::get<1>(x).get(piece_combo.setbonus);
-                    if (curr_setbonus_pieces < set_bonus_subset.at(piece_combo.setbonus)) {
-                        // TODO: Use something faster?
-                        std::get<1>(x).set(piece_combo.setbonus, curr_setbonus_pieces + 1);
-                    }
-                }
-                assert(std::get<0>(x).only_contains_skills_in_spec(skill_spec));(void)skill_spec;
-                return x;
-            };
 
-            armour_combos.add_using_callback(op1, op2());
+// Estimates how many armour combos are kept once combos with the skill maximums x have been merged.
+//
+// Combining seen sets keep combos that aren't subsets of each other, which can't number more than the
+// largest antichain of possible skill levels. That is taken to be the number of possible skill levels with
+// the middle sum of levels.
+static double estimate_antichain_size(const PackedSkills& x, const std::vector<PackedSkills::Field>& fields) {
+    std::vector<double> counts = {1}; // Indexed by sum of levels.
+    for (const PackedSkills::Field& f : fields) {
+        const unsigned int v = x.get(f);
+        std::vector<double> next (counts.size() + v, 0);
+        for (std::size_t i = 0; i < counts.size(); ++i) {
+            for (std::size_t j = 0; j <= v; ++j) next[i + j] += counts[i];
         }
+        counts = std::move(next);
     }
+    return counts[counts.size() / 2];
 }
 
 
-static void refilter_weapons(std::vector<std::tuple<DecoSlots,
-                                                    const Skill*,
-                                                    const SetBonus*,
-                                                    std::vector<WeaponInstanceExtended>>>& weapon_groups,
-                             const double max_total_damage,
-                             const std::size_t original_weapon_count) {
+// Chooses the order in which the armour slot lists are merged into armour_combos.
+//
+// Each merge costs the number of combos already merged times the size of the slot list, so the planner
+// tries every order and takes the one with the lowest estimated peak combo count, and then the fewest
+// estimated insertions. Combo counts after each merge are estimated as the lesser of the number of
+// combinations and the largest antichain of skill levels that the merged lists could reach, so slots that
+// share skills are estimated to prune each other well.
+//
+// Returns indices into slot_lists, in merge order. Ties keep the order of slot_lists.
+static std::vector<std::size_t> plan_merge_order(const SSBSeenMap<ArmourSetCombo>& armour_combos,
+                                                 const std::vector<const SSBSeenMapSmall<ArmourPieceCombo>*>& slot_lists,
+                                                 const std::vector<PackedSkills::Field>& fields,
+                                                 const SkillLayout& layout,
+                                                 const std::vector<std::string>& slot_names) {
+    assert(slot_lists.size() == slot_names.size());
+
+    PackedSkills initial_max;
+    for (const auto& e : armour_combos) {
+        initial_max = layout.field_max(initial_max, std::get<0>(e.first));
+    }
+    std::vector<PackedSkills> slot_maxes;
+    for (const SSBSeenMapSmall<ArmourPieceCombo> * const slot_list : slot_lists) {
+        PackedSkills x;
+        for (const auto& e : *slot_list) {
+            x = layout.field_max(x, e.second.packed_ssb);
+        }
+        slot_maxes.emplace_back(x);
+    }
+
+    std::vector<std::size_t> order (slot_lists.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    std::vector<std::size_t> best_order;
+    double best_peak = 0;
+    double best_insertions = 0;
+    do {
+        double size = armour_combos.size();
+        PackedSkills maxes = initial_max;
+        double peak = size;
+        double insertions = 0;
+        for (const std::size_t i : order) {
+            insertions += size * slot_lists[i]->size();
+            maxes.merge_in(slot_maxes[i], layout);
+            size = std::min(size * slot_lists[i]->size(), estimate_antichain_size(maxes, fields));
+            peak = std::max(peak, size);
+        }
+        if (best_order.empty()
+                || (peak < best_peak)
+                || ((peak == best_peak) && (insertions < best_insertions))) {
+            best_order = order;
+            best_peak = peak;
+            best_insertions = insertions;
+        }
+    } while (std::next_permutation(order.begin(), order.end()));
+
+    std::string plan;
+    for (const std::size_t i : best_order) {
+        plan += (plan.size() ? ", " : "") + slot_names[i];
+    }
+    Utils::log_stat("Armour merge order: " + plan);
+    // (The estimates can overflow the int overload.)
+    Utils::log_stat("Estimated peak armour combos: " + std::to_string(static_cast<unsigned long long>(best_peak)));
+    Utils::log_stat("Estimated armour combo insertions: "
+                    + std::to_string(static_cast<unsigned long long>(best_insertions)));
+
+    return best_order;
+}
+
+
+// Removes weapons that cannot beat max_total_damage, and any groups left empty.
+// If keep_ties is true, weapons that can only equal max_total_damage are kept.
+// Returns the number of weapons remaining.
+static std::size_t prune_weapons(WeaponGroups& weapon_groups,
+                                 const double max_total_damage,
+                                 const bool keep_ties) {
 
     std::size_t new_weapon_count = 0;
 
     // First, we prune within the individual groups
     const auto pred1 = [&](const WeaponInstanceExtended& x){
-        return x.ceiling_total_damage <= max_total_damage;
+        return keep_ties ? (x.ceiling_total_damage < max_total_damage)
+                         : (x.ceiling_total_damage <= max_total_damage);
     };
     for (auto& weapon_group_tup : weapon_groups) {
         auto& weapon_group = std::get<3>(weapon_group_tup);
+        const std::size_t old_size = weapon_group.size();
         weapon_group.erase(std::remove_if(weapon_group.begin(), weapon_group.end(), pred1), weapon_group.end());
+        if (weapon_group.size() && (weapon_group.size() != old_size)) {
+            std::get<4>(weapon_group_tup) = make_weapon_batch(weapon_group);
+        }
         new_weapon_count += weapon_group.size();
     }
 
     // Now, we prune away empty groups.
-    const auto pred2 = [&](const std::tuple<DecoSlots,
-                           const Skill*,
-                           const SetBonus*,
-                           std::vector<WeaponInstanceExtended>>& x){
+    const auto pred2 = [&](const WeaponGroups::value_type& x){
         return (!std::get<3>(x).size());
     };
     weapon_groups.erase(std::remove_if(weapon_groups.begin(), weapon_groups.end(), pred2), weapon_groups.end());
 
+    return new_weapon_count;
+}
+
+
+static void log_refilter(const double max_total_damage,
+                         const std::size_t original_weapon_count,
+                         const std::size_t new_weapon_count) {
     Utils::log_stat_reduction("\n\nRepruned weapons with Total Damage " + std::to_string(max_total_damage) + ": ",
                               original_weapon_count,
                               new_weapon_count);
 }
 
 
-static void do_search(const Database& db, const SearchParameters& params) {
+static void refilter_weapons(WeaponGroups& weapon_groups,
+                             const double max_total_damage,
+                             const std::size_t original_weapon_count) {
+    const std::size_t new_weapon_count = prune_weapons(weapon_groups, max_total_damage, false);
+    log_refilter(max_total_damage, original_weapon_count, new_weapon_count);
+}
 
-    auto total_start_t = std::chrono::steady_clock::now();
 
-    std::string initial_col1 = params.skill_spec.get_humanreadable();
-    std::string initial_col2;
+// Keeps the best builds found so far, up to a maximum number of builds.
+//
+// Builds are ranked by total damage, with ties going to the build from the earliest armour combo.
+// If distinct_weapons is set, at most one build is kept for each weapon.
+class TopBuilds {
+    std::size_t max_size;
+    bool        distinct_weapons;
+
+    // Heap ordered such that the lowest-ranked build kept is at the front.
+    std::vector<FoundBuild> heap;
+
+    double best_total_damage;
+public:
+    TopBuilds(const std::size_t new_max_size, const bool new_distinct_weapons) noexcept
+        : max_size          (new_max_size)
+        , distinct_weapons  (new_distinct_weapons)
+        , heap              {}
+        , best_total_damage (0)
+    {
+        assert(this->max_size);
+    }
 
-    const std::unordered_map<const SetBonus*, unsigned int> set_bonus_subset = [&](){
-        std::unordered_map<const SetBonus*, unsigned int> x;
+    static bool ranks_higher(const double      l_total_damage,
+                             const std::size_t l_armour_combo_index,
+                             const double      r_total_damage,
+                             const std::size_t r_armour_combo_index) noexcept {
+        return (l_total_damage > r_total_damage)
+               || ((l_total_damage == r_total_damage) && (l_armour_combo_index < r_armour_combo_index));
+    }
 
-        for (const SetBonus * const set_bonus : SkillsDatabase::g_all_setbonuses) {
-            for (const auto& e : set_bonus->stages) {
-                if (params.skill_spec.is_in_subset(e.second)
-                                && ((!Utils::map_has_key(x, set_bonus)) || (e.first > x[set_bonus])) ) {
-                    x[set_bonus] = e.first;
-                }
+    static bool ranks_higher(const FoundBuild& l, const FoundBuild& r) noexcept {
+        return ranks_higher(l.total_damage, l.armour_combo_index, r.total_damage, r.armour_combo_index);
+    }
+
+    // The total damage of the lowest-ranked build kept, once the container is full. Zero otherwise.
+    // Weapons that cannot exceed this value can no longer contribute new builds.
+    double threshold() const noexcept {
+        return (this->heap.size() < this->max_size) ? 0 : this->heap.front().total_damage;
+    }
+
+    // Quick test that must pass for try_add() to keep a build. Use it to avoid constructing FoundBuild.
+    bool might_keep(const double total_damage, const std::size_t armour_combo_index) const noexcept {
+        return (this->heap.size() < this->max_size)
+               || ranks_higher(total_damage,
+                               armour_combo_index,
+                               this->heap.front().total_damage,
+                               this->heap.front().armour_combo_index);
+    }
+
+    // Returns true if the build was kept.
+    bool try_add(FoundBuild&& b) {
+        if (this->distinct_weapons) {
+            const auto same_weapon = [&](const FoundBuild& x){
+                return x.weapon.instance.weapon == b.weapon.instance.weapon;
+            };
+            const auto result = std::find_if(this->heap.begin(), this->heap.end(), same_weapon);
+            if (result != this->heap.end()) {
+                if (!ranks_higher(b, *result)) return false;
+                this->update_best(b);
+                *result = std::move(b);
+                std::make_heap(this->heap.begin(), this->heap.end(), heap_cmp);
+                return true;
             }
         }
 
-        if (x.size()) {
-            initial_col1 += "\n\nSet bonuses to be considered:";
-            for (const auto& e : x) {
-                const SetBonus * const set_bonus = e.first;
-                initial_col1 += "\n  ";
-                initial_col1 += set_bonus->name;
+        if (this->heap.size() < this->max_size) {
+            this->update_best(b);
+            this->heap.emplace_back(std::move(b));
+            std::push_heap(this->heap.begin(), this->heap.end(), heap_cmp);
+            return true;
+        } else if (ranks_higher(b, this->heap.front())) {
+            this->update_best(b);
+            std::pop_heap(this->heap.begin(), this->heap.end(), heap_cmp);
+            this->heap.back() = std::move(b);
+            std::push_heap(this->heap.begin(), this->heap.end(), heap_cmp);
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    double get_best_total_damage() const noexcept {
+        return this->best_total_damage;
+    }
+
+    // Highest-ranked first.
+    std::vector<FoundBuild> get_sorted() const {
+        std::vector<FoundBuild> ret = this->heap;
+        std::sort(ret.begin(), ret.end(), heap_cmp);
+        return ret;
+    }
+
+    auto size() const noexcept {
+        return this->heap.size();
+    }
+
+private:
+    static bool heap_cmp(const FoundBuild& l, const FoundBuild& r) noexcept {
+        return ranks_higher(l, r);
+    }
+
+    void update_best(const FoundBuild& b) noexcept {
+        if (b.total_damage > this->best_total_damage) this->best_total_damage = b.total_damage;
+    }
+};
+
+
+static void log_found_build(const std::string& title,
+                            const FoundBuild& b,
+                            const SearchParameters& params,
+                            std::ostream& out=std::clog) {
+    const WeaponInstanceExtended& wc = b.weapon;
+    const ArmourSetCombo&         ac = b.armour_combo;
+
+    const std::string col1 = wc.instance.weapon->name + "\n\n"
+                             + wc.instance.upgrades->get_humanreadable() + "\n\n"
+                             + wc.instance.augments->get_humanreadable() + "\n\n"
+                             + "Armour:\n"
+                             + Utils::indent(ac.armour.get_humanreadable(), 4) + "\n\n"
+                             + "Decorations:\n"
+                             + Utils::indent(b.decos.get_humanreadable(), 4) + "\n\n"
+                             + "Buffs:\n"
+                             + Utils::indent(params.misc_buffs.get_humanreadable(), 4);
+
+    const std::string col2 = "Skills:\n"
+                             + Utils::indent(b.skills.get_humanreadable(), 4) + "\n\n"
+                             + "Effective Damage Values:\n"
+                             + Utils::indent(b.edv.get_humanreadable(), 4) + "\n\n"
+                             + "Model Damage Values:\n"
+                             + Utils::indent(b.mcv.get_humanreadable(), 4);
+
+    // Written all at once, since builds can be logged while another thread is logging.
+    out << "\n\n" + title + std::to_string(b.total_damage) + "\n\n"
+           + Utils::indent(Utils::two_column_text(col1, col2, "   |   "), 4) + "\n";
+}
+
+
+// Describes a found build as a JSON object. (See SearchOptions::results_jsonl_path.)
+static nlohmann::json found_build_to_json(const FoundBuild& b) {
+    static const std::array<std::pair<ArmourSlot, const char*>, 5> k_SLOT_KEYS = {{{ArmourSlot::head,  "head" },
+                                                                                  {ArmourSlot::chest, "chest"},
+                                                                                  {ArmourSlot::arms,  "arms" },
+                                                                                  {ArmourSlot::waist, "waist"},
+                                                                                  {ArmourSlot::legs,  "legs" }}};
+
+    const WeaponInstance& wi = b.weapon.instance;
+
+    // Armour pieces have no identifiers of their own, so they're named instead.
+    nlohmann::json armour = nlohmann::json::object();
+    for (const auto& e : k_SLOT_KEYS) {
+        const ArmourPiece * const piece = b.armour_combo.armour.get_piece(e.first);
+        armour[e.second] = piece ? nlohmann::json(piece->get_full_name()) : nlohmann::json(nullptr);
+    }
+    const Charm * const charm = b.armour_combo.armour.get_charm();
+
+    nlohmann::json decos = nlohmann::json::array();
+    for (const Decoration * const deco : b.decos) {
+        decos.push_back(deco->id);
+    }
+
+    return {{"total_damage",        b.total_damage},
+            {"actual_total_damage", b.mcv.actual_total_damage},
+            {"efr",                 b.edv.efr},
+            {"efes",                b.edv.efes},
+            {"affinity",            b.edv.affinity},
+            {"weapon",              wi.weapon->id},
+            {"augments",            wi.augments->get_humanreadable()},
+            {"upgrades",            wi.upgrades->get_humanreadable()},
+            {"armour",              std::move(armour)},
+            {"charm",               charm ? nlohmann::json({{"id", charm->id}, {"level", charm->max_charm_lvl}})
+                                          : nlohmann::json(nullptr)},
+            {"decorations",         std::move(decos)}};
+}
+
+
+// Logs each new best build as it's found, on a separate thread, so that the search doesn't wait on
+// formatting. Builds are recorded in a compact form (without merging their decos), and are logged in the order
+// they were added.
+//
+// While builds may still be waiting to be logged, anything else the search logs must go through add_log(), or
+// it could be reordered with the builds. (Once finish() returns, the search can log directly again.)
+// The thread is only started once something is added.
+//
+// If jsonl isn't null, each build is also written to it as a JSON line.
+class NewBestLogger {
+    struct Record {
+        double                                total_damage;
+        std::size_t                           armour_combo_index;
+        WeaponInstance                        weapon;
+        ArmourSetCombo                        armour_combo;
+        std::vector<const Decoration*>        weapon_decos; // Copied, so records don't depend on any cache.
+        SkillMap                              skills;
+        EffectiveDamageValues                 edv;
+        ModelCalculatedValues                 mcv;
+    };
+
+    // Either a new best build, or other log output (if fn is set).
+    struct Entry {
+        std::optional<Record> build;
+        std::function<void()> fn;
+    };
+
+    const SearchParameters& params;
+    const DecoComboTable&   deco_table;
+    std::ostream* const     jsonl;
+
+    std::mutex              mutex;
+    std::condition_variable cv;
+    std::deque<Entry>       queue;
+    bool                    finished;
+
+    std::thread worker;
+public:
+    NewBestLogger(const SearchParameters& new_params,
+                  const DecoComboTable& new_deco_table,
+                  std::ostream* const new_jsonl) noexcept
+        : params     (new_params)
+        , deco_table (new_deco_table)
+        , jsonl      (new_jsonl)
+        , mutex      {}
+        , cv         {}
+        , queue      {}
+        , finished   {false}
+        , worker     {}
+    {
+    }
+
+    ~NewBestLogger() {
+        this->finish();
+    }
+
+    // weapon_decos must be the decos b added to the weapon.
+    void add(const FoundBuild& b, const std::vector<const Decoration*>& weapon_decos) {
+        this->push({Record{b.total_damage,
+                           b.armour_combo_index,
+                           b.weapon.instance,
+                           b.armour_combo,
+                           weapon_decos,
+                           b.skills,
+                           b.edv,
+                           b.mcv },
+                    {} });
+    }
+
+    // Calls fn on the logging thread, after every build added so far is logged.
+    void add_log(std::function<void()>&& fn) {
+        this->push({std::nullopt, std::move(fn)});
+    }
+
+    // Waits for everything added so far to be logged. Nothing more may be added afterwards.
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lock (this->mutex);
+            this->finished = true;
+        }
+        this->cv.notify_one();
+        if (this->worker.joinable()) this->worker.join();
+    }
+
+private:
+    void push(Entry&& e) {
+        {
+            std::lock_guard<std::mutex> lock (this->mutex);
+            assert(!this->finished);
+            this->queue.push_back(std::move(e));
+        }
+        if (!this->worker.joinable()) {
+            this->worker = std::thread([this](){ this->run(); });
+        }
+        this->cv.notify_one();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock (this->mutex);
+        while (true) {
+            this->cv.wait(lock, [this](){ return this->finished || !this->queue.empty(); });
+            if (this->queue.empty()) return;
+
+            const Entry e = std::move(this->queue.front());
+            this->queue.pop_front();
+            lock.unlock();
+
+            if (e.build) {
+                this->log_build(*e.build);
+            } else {
+                e.fn();
             }
+
+            lock.lock();
         }
+    }
 
-        return x;
-    }();
+    void log_build(const Record& r) const {
+        DecoEquips decos = std::vector<const Decoration*>(r.weapon_decos);
+        decos.merge_in(r.armour_combo.get_decos(this->deco_table));
+
+        // Logging only needs the weapon instance, so the weapon's contributions are left empty.
+        const FoundBuild b = {r.total_damage,
+                              r.armour_combo_index,
+                              {r.weapon, {}, 0},
+                              r.armour_combo,
+                              std::move(decos),
+                              r.skills,
+                              r.edv,
+                              r.mcv };
+
+        log_found_build("Found Total Damage: ", b, this->params);
+        if (this->jsonl) {
+            nlohmann::json j = found_build_to_json(b);
+            j["event"] = "new_best";
+            *this->jsonl << j.dump() + "\n";
+        }
+    }
+};
 
-    initial_col2 += "Buffs:\n"
-                    + Utils::indent(params.misc_buffs.get_humanreadable(), 2)
-                    + "\n\nDamage Model:\n"
-                    + Utils::indent(params.damage_model.get_humanreadable(), 2);
 
-    std::clog << Utils::two_column_text(initial_col1, initial_col2, "   |    ") + "\n\n";
+// sorted_results must be highest-ranked first.
+static void log_ranked_builds(const std::vector<FoundBuild>& sorted_results,
+                              const SearchParameters& params,
+                              const SearchOptions& options,
+                              std::ostream& out) {
+    if (options.num_results == 1) {
+        if (sorted_results.size()) log_found_build("Found Total Damage: ", sorted_results.front(), params, out);
+    } else {
+        for (std::size_t i = 0; i < sorted_results.size(); ++i) {
+            const std::string title = "Rank " + std::to_string(i + 1) + " of " + std::to_string(sorted_results.size())
+                                      + " - Total Damage: ";
+            log_found_build(title, sorted_results[i], params, out);
+        }
+    }
+}
 
-    std::size_t weapons_initial_size; // TODO: make constant
-    std::vector<std::tuple<DecoSlots, const Skill*, const SetBonus*, std::vector<WeaponInstanceExtended>>> weapons = [&](){
-        std::vector<WeaponInstanceExtended> weapons = prepare_weapons(db, params, set_bonus_subset);
-        weapons_initial_size = weapons.size();
-        assert(weapons_initial_size);
-        return group_weapons(std::move(weapons));
-    }();
 
-    auto start_t = std::chrono::steady_clock::now();
+// Evaluates every weapon in weapon_groups against a single armour combo, offering every build to results.
+//
+// Builds with a total damage below shared_bound are skipped without being offered.
+// on_new_best(const FoundBuild&, const std::vector<const Decoration*>& weapon_decos) is called whenever a build
+// beats the best total damage in results. weapon_decos are the decos added to the weapon, as held by deco_cache.
+//
+// Returns true if results kept anything.
+template<class NewBestFn>
+static bool evaluate_armour_combo(const PackedSSBTuple& ac_ssb,
+                                  const ArmourSetCombo& ac,
+                                  const std::size_t ac_index,
+                                  const WeaponGroups& weapons,
+                                  DecoComboCache& deco_cache,
+                                  SharedSkillContributionCache& sc_cache,
+                                  const DecoComboTable& deco_table,
+                                  const SearchParameters& params,
+                                  const SkillLayout& layout,
+                                  const double shared_bound,
+                                  TopBuilds& results,
+                                  const NewBestFn& on_new_best,
+                                  std::size_t& stat_wa_combos_explored,
+                                  std::size_t& stat_wad_combos_explored) {
+    bool found = false;
+    std::vector<double> total_damages; // Reused for each weapon batch.
+    for (const auto& weapon_group_tup : weapons) {
+        const DecoSlots& deco_slots = std::get<0>(weapon_group_tup);
+        const Skill * const skill = std::get<1>(weapon_group_tup);
+        const SetBonus * const setbonus = std::get<2>(weapon_group_tup);
+        const std::vector<WeaponInstanceExtended>& weapon_group = std::get<3>(weapon_group_tup);
+        const WeaponBatch& weapon_batch = std::get<4>(weapon_group_tup);
+
+        const SetBonusMap wac_set_bonuses = [&](){
+            SetBonusMap x = ac.armour.get_set_bonuses();
+            if (setbonus) x.increment(setbonus, 1);
+            return x;
+        }();
+
+        // Filter out anything that exceeds set bonus cutoffs.
+        bool invalid_set_bonuses = false;
+        for (const auto& e : params.skill_spec.get_set_bonus_cutoffs()) {
+            assert(wac_set_bonuses.get(e.first) <= e.second);
+            if (wac_set_bonuses.get(e.first) == e.second) {
+                invalid_set_bonuses = true;
+                break;
+            }
+        }
+        if (invalid_set_bonuses) {
+            continue;
+        }
 
-    std::array<std::vector<const Decoration*>, k_MAX_DECO_SIZE> grouped_sorted_decos = prepare_decos(db, params.skill_spec);
-    assert(grouped_sorted_decos.size() == 4);
-    assert(grouped_sorted_decos[0].size());
-    assert(grouped_sorted_decos[1].size());
-    assert(grouped_sorted_decos[2].size());
-    assert(grouped_sorted_decos[3].size());
-
-    std::vector<const Charm*> charms = prepare_charms(db, params.skill_spec);
-    assert(charms.size());
-
-    std::map<ArmourSlot, std::vector<const ArmourPiece*>> armour = prepare_armour(db, params);
-
-    assert(armour.size() == 5);
-    assert(armour.at(ArmourSlot::head).size());
-    assert(armour.at(ArmourSlot::chest).size());
-    assert(armour.at(ArmourSlot::arms).size());
-    assert(armour.at(ArmourSlot::waist).size());
-    assert(armour.at(ArmourSlot::legs).size());
-
-    SSBSeenMapSmall<ArmourPieceCombo> head_combos = generate_slot_combos(armour.at(ArmourSlot::head),
-                                                                         grouped_sorted_decos,
-                                                                         params.skill_spec,
-                                                                         set_bonus_subset,
-                                                                         "Generated head+deco  combinations: ");
-    SSBSeenMapSmall<ArmourPieceCombo> chest_combos = generate_slot_combos(armour.at(ArmourSlot::chest),
-                                                                          grouped_sorted_decos,
-                                                                          params.skill_spec,
-                                                                          set_bonus_subset,
-                                                                          "Generated chest+deco combinations: ");
-    SSBSeenMapSmall<ArmourPieceCombo> arms_combos = generate_slot_combos(armour.at(ArmourSlot::arms),
-                                                                         grouped_sorted_decos,
-                                                                         params.skill_spec,
-                                                                         set_bonus_subset,
-                                                                         "Generated arms+deco  combinations: ");
-    SSBSeenMapSmall<ArmourPieceCombo> waist_combos = generate_slot_combos(armour.at(ArmourSlot::waist),
-                                                                          grouped_sorted_decos,
-                                                                          params.skill_spec,
-                                                                          set_bonus_subset,
-                                                                          "Generated waist+deco combinations: ");
-    SSBSeenMapSmall<ArmourPieceCombo> legs_combos = generate_slot_combos(armour.at(ArmourSlot::legs),
-                                                                         grouped_sorted_decos,
-                                                                         params.skill_spec,
-                                                                         set_bonus_subset,
-                                                                         "Generated legs+deco  combinations: ");
-    Utils::log_stat_duration("  >>> decos, charms, and armour slot combos: ", start_t);
-    Utils::log_stat();
+        // wac_skills includes all set bonus skills.
+        const SkillMap wac_skills = [&](){
+            SkillMap x = layout.unpack_skills(std::get<0>(ac_ssb)); // "Weapon-armour-combo"
+            x.add_set_bonuses(wac_set_bonuses);
+            if (skill) x.increment(skill, 1);
+            return x;
+        }();
+        const PackedSkills wac_packed = layout.pack(wac_skills);
 
-    // We build the initial build list.
-    
-    start_t = std::chrono::steady_clock::now();
-    SSBSeenMap<ArmourSetCombo> armour_combos = [&](){
-        std::vector<const Skill*> sk_vec = get_skills_in_subset_servable_without_sb_or_weapons(db, params.skill_spec);
+        // Skip the group if no weapon could give a build that would be kept, even with the best deco fill.
+        // Like ceiling_total_damage (see prepare_weapons()), this relies on total damage never decreasing
+        // as skill levels increase.
+        const PackedSkills& fill = deco_cache.get_fill(deco_slots);
+        {
+            PackedSkills packed = wac_packed;
+            packed.merge_in(fill, layout);
+            if (!layout.meets_minimum_requirements(packed)) continue;
+        }
+        if ((shared_bound > 0) || (results.threshold() > 0)) {
+            SkillMap skills = wac_skills;
+            for (const auto& e : layout.unpack_skills(fill)) {
+                skills.increment(e.first, e.second);
+            }
+            weapon_batch.calculate_total_damage(sc_cache.get(skills),
+                                                params.misc_buffs,
+                                                params.damage_model,
+                                                total_damages);
+            const double max_total_damage = *std::max_element(total_damages.begin(), total_damages.end());
+            if ((max_total_damage < shared_bound) || (!results.might_keep(max_total_damage, ac_index))) continue;
+        }
+
+        const std::vector<DecoCombo>& w_decos = deco_cache.get(deco_slots, wac_packed);
+        for (const DecoCombo& deco_combo : w_decos) {
+            const std::vector<const Decoration*>& dc = deco_combo.first;
+
+            // Filter out anything that doesn't meet minimum requirements
+            const PackedSkills packed = [&](){
+                PackedSkills x = wac_packed;
+                x.merge_in(deco_combo.second, layout);
+                return x;
+            }();
+            if (!layout.meets_minimum_requirements(packed)) continue;
+
+            const SkillMap skills = [&](){
+                SkillMap x = wac_skills;
+                x.merge_in(dc);
+                return x;
+            }();
+            assert(params.skill_spec.skills_meet_minimum_requirements(skills));
+
+            ++stat_wa_combos_explored;
+            stat_wad_combos_explored += weapon_group.size();
+
+            weapon_batch.calculate_total_damage(sc_cache.get(skills),
+                                                params.misc_buffs,
+                                                params.damage_model,
+                                                total_damages);
+
+            for (std::size_t i = 0; i < weapon_group.size(); ++i) {
+                const WeaponInstanceExtended& wc = weapon_group[i];
+                const double total_damage = total_damages[i];
+
+                assert((!params.health_regen_required) || wc.contributions.health_regen_active);
+
+                if ((total_damage >= shared_bound) && results.might_keep(total_damage, ac_index)) {
+                    // The full breakdown is only needed for builds we keep.
+                    const EffectiveDamageValues edv = calculate_edv_from_skills_lookup(wc.instance.weapon->weapon_class,
+                                                                                       wc.contributions,
+                                                                                       skills,
+                                                                                       params.misc_buffs,
+                                                                                       params.skill_spec);
+                    const ModelCalculatedValues mcv = calculate_damage(params.damage_model, edv);
+                    assert(mcv.unrounded_total_damage == total_damage);
+
+                    const bool is_new_best = (total_damage > results.get_best_total_damage());
+
+                    DecoEquips curr_decos = [&](){
+                        // We copy since later weapons in the group may also use dc.
+                        DecoEquips x = std::vector<const Decoration*>(dc);
+                        x.merge_in(ac.get_decos(deco_table));
+                        assert(x.fits_in(ac.armour, wc.contributions));
+                        return x;
+                    }();
+
+                    FoundBuild b = {total_damage,
+                                    ac_index,
+                                    wc,
+                                    ac,
+                                    std::move(curr_decos),
+                                    skills,
+                                    edv,
+                                    mcv };
+                    if (is_new_best) on_new_best(b, dc);
+                    if (results.try_add(std::move(b))) found = true;
+                }
+
+            }
+
+        }
+
+    }
+    return found;
+}
+
+
+// Quickly finds some good builds by only keeping the most promising partial armour combos after each merge
+// (i.e. a beam search). Partial combos closest to meeting minimum requirements are kept first, then those
+// with the most skill levels and set bonus pieces.
+//
+// Returns the threshold a results container (as specified by options) would have after taking these
+// builds. Since these builds are also found by the full search, this is a lower bound for the threshold of
+// the full search.
+static double find_incumbent_threshold(const SSBSeenMap<ArmourSetCombo>& charm_combos,
+                                       const std::vector<const SSBSeenMapSmall<ArmourPieceCombo>*>& slot_lists,
+                                       const WeaponGroups& weapons,
+                                       DecoComboCache& deco_cache,
+                                       const DecoComboTable& deco_table,
+                                       const SearchParameters& params,
+                                       const SkillLayout& layout,
+                                       const SearchOptions& options,
+                                       const std::size_t beam_width) {
+    // For each skill with a minimum level, the set bonus stages that also provide it.
+    using Field = PackedSkills::Field;
+    std::vector<std::tuple<Field, unsigned int, std::vector<std::pair<Field, unsigned int>>>> requirements;
+    for (const auto& e : params.skill_spec) {
+        if (!e.second) continue;
+        std::vector<std::pair<Field, unsigned int>> set_bonus_stages;
+        for (const SetBonus * const set_bonus : SkillsDatabase::g_all_setbonuses) {
+            if (!layout.contains(set_bonus)) continue;
+            for (const auto& stage : set_bonus->stages) {
+                if (stage.second == e.first) set_bonus_stages.emplace_back(layout.field(set_bonus), stage.first);
+            }
+        }
+        requirements.emplace_back(layout.field(e.first), e.second, std::move(set_bonus_stages));
+    }
+
+    // How far x is from meeting minimum requirements. For each skill, this is the number of levels still
+    // needed, or if a set bonus provides the skill, the fewest set bonus pieces still needed to get it.
+    const auto shortfall = [&](const PackedSkills& x){
+        unsigned int ret = 0;
+        for (const auto& e : requirements) {
+            const unsigned int lvl = x.get(std::get<0>(e));
+            if (lvl >= std::get<1>(e)) continue;
+            if (!std::get<2>(e).size()) {
+                ret += std::get<1>(e) - lvl;
+                continue;
+            }
+            unsigned int v = std::numeric_limits<unsigned int>::max();
+            for (const auto& stage : std::get<2>(e)) {
+                const unsigned int pieces = x.get(stage.first);
+                v = std::min(v, (pieces < stage.second) ? (stage.second - pieces) : 0);
+            }
+            ret += v;
+        }
+        return ret;
+    };
+
+    const auto truncate = [&](const SSBSeenMap<ArmourSetCombo>& x){
+        auto v = x.get_data_as_vector();
+
+        std::vector<std::tuple<unsigned int, int, std::size_t>> ranks; // Sorted in ascending order.
+        for (std::size_t i = 0; i < v.size(); ++i) {
+            const PackedSkills& packed = std::get<0>(v[i].first);
+            ranks.emplace_back(shortfall(packed), -static_cast<int>(layout.sum(packed)), i);
+        }
+        std::sort(ranks.begin(), ranks.end());
+        if (ranks.size() > beam_width) ranks.resize(beam_width);
+
+        SSBSeenMap<ArmourSetCombo> ret = x.clone_empty();
+        for (const auto& e : ranks) {
+            auto& entry = v[std::get<2>(e)];
+            ret.add(std::move(entry.second), std::move(entry.first));
+        }
+        return ret;
+    };
+
+    SSBSeenMap<ArmourSetCombo> beam = truncate(charm_combos);
+    for (std::size_t i = 0; i < slot_lists.size(); ++i) {
+        merge_in_armour_list(beam, *slot_lists[i], params.skill_spec, layout, i, 1);
+        beam = truncate(beam);
+    }
+
+    TopBuilds results (options.num_results, options.distinct_weapons);
+    WeaponGroups local_weapons = weapons;
+    SharedSkillContributionCache sc_cache (params.skill_spec, params.weapon_class);
+    std::size_t ac_index = 0;
+    std::size_t stat_wa_combos_explored = 0;
+    std::size_t stat_wad_combos_explored = 0;
+    const auto on_new_best = [](const FoundBuild&, const std::vector<const Decoration*>&){};
+    for (const auto& e : beam) {
+        evaluate_armour_combo(e.first,
+                              e.second,
+                              ac_index++,
+                              local_weapons,
+                              deco_cache,
+                              sc_cache,
+                              deco_table,
+                              params,
+                              layout,
+                              0,
+                              results,
+                              on_new_best,
+                              stat_wa_combos_explored,
+                              stat_wad_combos_explored);
+        // Weapons that can only tie the threshold can't raise it.
+        if (results.threshold() > 0) prune_weapons(local_weapons, results.threshold(), false);
+    }
+    return results.threshold();
+}
+
+
+// Orders complete armour combos by descending optimistic score, so that strong builds are found early and
+// weapons are pruned by a tight threshold for most of the final evaluation loop.
+//
+// The score is the total damage of the weapon with the highest damage ceiling, with only the armour combo's
+// skills. (It's only used for ordering, so it doesn't need to be an upper bound.)
+//
+// armour_combos can be any container of (PackedSSBTuple, ArmourSetCombo) pairs, and must outlive the
+// returned pointers. Ties keep iteration order.
+template<class ArmourCombos>
+static auto order_best_first(const ArmourCombos& armour_combos,
+                             const WeaponGroups& weapon_groups,
+                             const SearchParameters& params,
+                             const SkillLayout& layout) {
+    using Entry = std::remove_reference_t<decltype(*armour_combos.begin())>;
+
+    const WeaponInstanceExtended* best_weapon = nullptr;
+    for (const auto& e : weapon_groups) {
+        for (const WeaponInstanceExtended& wc : std::get<3>(e)) {
+            if ((!best_weapon) || (wc.ceiling_total_damage > best_weapon->ceiling_total_damage)) best_weapon = &wc;
+        }
+    }
+
+    std::vector<std::pair<double, const Entry*>> scored;
+    scored.reserve(armour_combos.size());
+    for (const auto& e : armour_combos) {
+        double score = 0;
+        if (best_weapon) {
+            SkillMap skills = layout.unpack_skills(std::get<0>(e.first));
+            skills.add_set_bonuses(layout.unpack_set_bonuses(std::get<0>(e.first)));
+            const EffectiveDamageValues edv = calculate_edv_from_skills_lookup(best_weapon->instance.weapon->weapon_class,
+                                                                               best_weapon->contributions,
+                                                                               skills,
+                                                                               params.misc_buffs,
+                                                                               params.skill_spec);
+            score = calculate_damage(params.damage_model, edv).unrounded_total_damage;
+        }
+        scored.emplace_back(score, &e);
+    }
+
+    const auto cmp = [](const std::pair<double, const Entry*>& a, const std::pair<double, const Entry*>& b){
+        return a.first > b.first;
+    };
+    std::stable_sort(scored.begin(), scored.end(), cmp);
+
+    std::vector<const Entry*> ret;
+    ret.reserve(scored.size());
+    for (const auto& e : scored) {
+        ret.emplace_back(e.second);
+    }
+    return ret;
+}
+
+
+// Multithreaded version of the final weapon/armour/deco evaluation loop.
+//
+// Armour combos are handed out to workers in chunks, in iteration order. Each worker keeps its own results
+// and its own copy of the weapon groups. Weapons are pruned against a shared bound, which is the highest
+// threshold of any worker (and therefore a lower bound for the final threshold).
+//
+// To produce the same results as the single-threaded loop, workers keep weapons that can only tie the
+// shared bound, and the final results are merged in rank order. (The only exception is when different
+// builds for the same armour combo tie exactly, which may be resolved differently if more than one
+// result is requested.) Do note that sharded merges (see merge_in_armour_list()) can change the iteration
+// order of armour combos, and therefore which of several exactly tied builds is reported.
+//
+// Armour combo indices start from ac_index_offset, and initial_bound must be a lower bound for the final
+// threshold (e.g. the threshold of builds found in earlier chunks of armour combos).
+//
+// ac_vec points to (PackedSSBTuple, ArmourSetCombo) pairs, in iteration order. (See order_best_first().)
+//
+// Each worker uses the caches with its own index, so that they stay warm between calls.
+template<class Entry>
+static TopBuilds find_top_builds_multithreaded(const std::vector<const Entry*>& ac_vec,
+                                               const std::size_t ac_index_offset,
+                                               const double initial_bound,
+                                               const WeaponGroups& weapons,
+                                               std::vector<DecoComboCache>& worker_caches,
+                                               std::vector<SharedSkillContributionCache>& worker_sc_caches,
+                                               const DecoComboTable& deco_table,
+                                               const SearchParameters& params,
+                                               const SkillLayout& layout,
+                                               const SearchOptions& options,
+                                               std::size_t& stat_wa_combos_explored,
+                                               std::size_t& stat_wad_combos_explored) {
+    static constexpr std::size_t k_CHUNK_SIZE = 16;
+
+    const std::size_t num_threads = options.num_threads;
+    assert(num_threads > 1);
+    assert(worker_caches.size() == num_threads);
+    assert(worker_sc_caches.size() == num_threads);
+
+    std::atomic<std::size_t> next_index {0};
+    std::atomic<double>      shared_bound {initial_bound};
+
+    std::vector<TopBuilds> worker_results (num_threads, TopBuilds(options.num_results, options.distinct_weapons));
+    std::vector<std::size_t> worker_stat_wa (num_threads, 0);
+    std::vector<std::size_t> worker_stat_wad (num_threads, 0);
+
+    const auto worker = [&](const std::size_t thread_index){
+        TopBuilds& results = worker_results[thread_index];
+        WeaponGroups local_weapons = weapons;
+        SharedSkillContributionCache& sc_cache = worker_sc_caches[thread_index];
+        double pruned_at = 0;
+
+        const auto on_new_best = [](const FoundBuild&, const std::vector<const Decoration*>&){};
+
+        for (;;) {
+            const std::size_t lo = next_index.fetch_add(k_CHUNK_SIZE);
+            if (lo >= ac_vec.size()) break;
+            const std::size_t hi = std::min(lo + k_CHUNK_SIZE, ac_vec.size());
+
+            for (std::size_t i = lo; i < hi; ++i) {
+                const bool found = evaluate_armour_combo(ac_vec[i]->first,
+                                                         ac_vec[i]->second,
+                                                         ac_index_offset + i,
+                                                         local_weapons,
+                                                         worker_caches[thread_index],
+                                                         sc_cache,
+                                                         deco_table,
+                                                         params,
+                                                         layout,
+                                                         shared_bound.load(),
+                                                         results,
+                                                         on_new_best,
+                                                         worker_stat_wa[thread_index],
+                                                         worker_stat_wad[thread_index]);
+                if (found) {
+                    const double local_threshold = results.threshold();
+                    double prev = shared_bound.load();
+                    while ((prev < local_threshold) && !shared_bound.compare_exchange_weak(prev, local_threshold));
+                }
+
+                const double bound = shared_bound.load();
+                if (bound > pruned_at) {
+                    prune_weapons(local_weapons, bound, true);
+                    pruned_at = bound;
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < num_threads; ++i) {
+        threads.emplace_back(worker, i);
+    }
+    for (std::thread& t : threads) {
+        t.join();
+    }
+
+    std::vector<FoundBuild> all_builds;
+    for (std::size_t i = 0; i < num_threads; ++i) {
+        stat_wa_combos_explored += worker_stat_wa[i];
+        stat_wad_combos_explored += worker_stat_wad[i];
+
+        std::vector<FoundBuild> builds = worker_results[i].get_sorted();
+        std::move(builds.begin(), builds.end(), std::back_inserter(all_builds));
+    }
+    const auto cmp = [](const FoundBuild& l, const FoundBuild& r){
+        return TopBuilds::ranks_higher(l, r);
+    };
+    std::stable_sort(all_builds.begin(), all_builds.end(), cmp);
+
+    TopBuilds ret (options.num_results, options.distinct_weapons);
+    for (FoundBuild& b : all_builds) {
+        ret.try_add(std::move(b));
+    }
+    return ret;
+}
+
+
+// The armour side of a search, from decos up to the combining seen set that the complete armour combos
+// are merged into. Armour combos refer to the stage's slot combos and deco table, so they're kept together.
+struct ArmourStage {
+    // The search parameters that the armour combos depend on. Nothing else (e.g. the damage model, buffs,
+    // or weapon filters) affects them.
+    struct Key {
+        bool allow_low_rank;
+        bool allow_high_rank;
+        bool allow_master_rank;
+
+        std::map<const Skill*, unsigned int> min_levels;
+        std::set<const Skill*>               force_remove_skills;
+
+        explicit Key(const SearchParameters& params)
+            : allow_low_rank      (params.allow_low_rank)
+            , allow_high_rank     (params.allow_high_rank)
+            , allow_master_rank   (params.allow_master_rank)
+            , min_levels          (params.skill_spec.begin(), params.skill_spec.end())
+            , force_remove_skills {}
+        {
+            for (const Skill * const skill : SkillsDatabase::g_all_skills) {
+                if (params.skill_spec.skill_must_be_removed(skill)) force_remove_skills.emplace(skill);
+            }
+        }
+
+        bool operator==(const Key& other) const noexcept {
+            return (this->allow_low_rank == other.allow_low_rank)
+                   && (this->allow_high_rank == other.allow_high_rank)
+                   && (this->allow_master_rank == other.allow_master_rank)
+                   && (this->min_levels == other.min_levels)
+                   && (this->force_remove_skills == other.force_remove_skills);
+        }
+    };
+
+    const Key key;
+
+    // Copied, since the stage can outlive the search parameters it was made from.
+    const SkillSpec                                          skill_spec;
+    const std::unordered_map<const SetBonus*, unsigned int> set_bonus_subset;
+    const SkillLayout                                        layout;
+
+    const std::array<std::vector<const Decoration*>, k_MAX_DECO_SIZE> grouped_sorted_decos;
+
+    DecoComboCache deco_cache;
+    DecoComboTable deco_table;
+
+    const std::map<ArmourSlot, std::vector<const ArmourPiece*>> armour;
+
+    const SSBSeenMapSmall<ArmourPieceCombo> head_combos;
+    const SSBSeenMapSmall<ArmourPieceCombo> chest_combos;
+    const SSBSeenMapSmall<ArmourPieceCombo> arms_combos;
+    const SSBSeenMapSmall<ArmourPieceCombo> waist_combos;
+    const SSBSeenMapSmall<ArmourPieceCombo> legs_combos;
+
+    const std::vector<PackedSkills::Field> seen_map_fields; // The combining seen set's keys, in tree order.
+
+    SSBSeenMap<ArmourSetCombo> armour_combos; // Empty until the search merges combos into it.
+
+    ArmourStage(const Database& db,
+                const SearchParameters& params,
+                const std::unordered_map<const SetBonus*, unsigned int>& new_set_bonus_subset)
+        : key                  (params)
+        , skill_spec           (params.skill_spec)
+        , set_bonus_subset     (new_set_bonus_subset)
+        , layout               (skill_spec, set_bonus_subset)
+        , grouped_sorted_decos (prepare_decos(db, skill_spec))
+        , deco_cache           (grouped_sorted_decos, layout)
+        , deco_table           (skill_spec)
+        , armour               (prepare_armour(db, params))
+        , head_combos          (this->generate(ArmourSlot::head,  "Generated head+deco  combinations: "))
+        , chest_combos         (this->generate(ArmourSlot::chest, "Generated chest+deco combinations: "))
+        , arms_combos          (this->generate(ArmourSlot::arms,  "Generated arms+deco  combinations: "))
+        , waist_combos         (this->generate(ArmourSlot::waist, "Generated waist+deco combinations: "))
+        , legs_combos          (this->generate(ArmourSlot::legs,  "Generated legs+deco  combinations: "))
+        , seen_map_fields      (this->make_seen_map_fields(db))
+        , armour_combos        (std::vector<PackedSkills::Field>(seen_map_fields))
+    {
+    }
+
+    // In the same order as get_slot_names().
+    std::vector<const SSBSeenMapSmall<ArmourPieceCombo>*> get_slot_lists() const {
+        return {&this->head_combos, &this->chest_combos, &this->arms_combos, &this->waist_combos, &this->legs_combos};
+    }
+
+    static std::vector<std::string> get_slot_names() {
+        return {"head", "chest", "arms", "waist", "legs"};
+    }
+
+private:
+    SSBSeenMapSmall<ArmourPieceCombo> generate(const ArmourSlot slot, const std::string& debug_msg) {
+        assert(this->grouped_sorted_decos.size() == 4);
+        assert(this->grouped_sorted_decos[0].size());
+        assert(this->grouped_sorted_decos[1].size());
+        assert(this->grouped_sorted_decos[2].size());
+        assert(this->grouped_sorted_decos[3].size());
+        assert(this->armour.size() == 5);
+        if (!this->armour.at(slot).size()) {
+            throw std::runtime_error("No armour pieces of some armour slot match the search parameters.");
+        }
+        return generate_slot_combos(this->armour.at(slot),
+                                    this->deco_cache,
+                                    this->deco_table,
+                                    this->skill_spec,
+                                    this->set_bonus_subset,
+                                    this->layout,
+                                    debug_msg);
+    }
+
+    std::vector<PackedSkills::Field> make_seen_map_fields(const Database& db) const {
+        std::vector<const Skill*> sk_vec = get_skills_in_subset_servable_without_sb_or_weapons(db, this->skill_spec);
         Utils::log_stat("Skills to be considered by the combining seen set: ", sk_vec.size());
         std::unordered_set<const SetBonus*> sb_set;
-        for (const auto& e : armour) {
+        for (const auto& e : this->armour) {
             for (const ArmourPiece * const piece : e.second) {
-                if (Utils::map_has_key(set_bonus_subset, piece->set_bonus)) {
+                if (Utils::map_has_key(this->set_bonus_subset, piece->set_bonus)) {
                     sb_set.emplace(piece->set_bonus);
                 }
             }
@@ -829,182 +2230,408 @@ static void do_search(const Database& db, const SearchParameters& params) {
         std::vector<const SetBonus*> sb_vec (sb_set.begin(), sb_set.end());
         Utils::log_stat("Set bonuses to be considered by the combining seen set: ", sb_vec.size());
 
-        return SSBSeenMap<ArmourSetCombo>(std::move(sk_vec), std::move(sb_vec));
+        // Skills come before set bonuses in the tree, as they did when they were in separate counters.
+        std::vector<PackedSkills::Field> key_order = this->layout.fields(sk_vec);
+        const std::vector<PackedSkills::Field> sb_fields = this->layout.fields(sb_vec);
+        key_order.insert(key_order.end(), sb_fields.begin(), sb_fields.end());
+        return key_order;
+    }
+};
+
+
+// on_results(const std::vector<FoundBuild>&) is called once with the final results, highest-ranked first.
+template<class ResultsFn>
+static void do_search(const Database& db,
+                      const SearchParameters& params,
+                      const SearchOptions& options,
+                      SearchCache& cache,
+                      ResultsFn&& on_results) {
+
+    auto total_start_t = std::chrono::steady_clock::now();
+
+    std::string initial_col1 = params.skill_spec.get_humanreadable();
+    std::string initial_col2;
+
+    const std::unordered_map<const SetBonus*, unsigned int> set_bonus_subset = [&](){
+        std::unordered_map<const SetBonus*, unsigned int> x;
+
+        for (const SetBonus * const set_bonus : SkillsDatabase::g_all_setbonuses) {
+            for (const auto& e : set_bonus->stages) {
+                if (params.skill_spec.is_in_subset(e.second)
+                                && ((!Utils::map_has_key(x, set_bonus)) || (e.first > x[set_bonus])) ) {
+                    x[set_bonus] = e.first;
+                }
+            }
+        }
+
+        if (x.size()) {
+            initial_col1 += "\n\nSet bonuses to be considered:";
+            for (const auto& e : x) {
+                const SetBonus * const set_bonus = e.first;
+                initial_col1 += "\n  ";
+                initial_col1 += set_bonus->name;
+            }
+        }
+
+        return x;
+    }();
+
+    initial_col2 += "Buffs:\n"
+                    + Utils::indent(params.misc_buffs.get_humanreadable(), 2)
+                    + "\n\nDamage Model:\n"
+                    + Utils::indent(params.damage_model.get_humanreadable(), 2);
+
+    std::clog << Utils::two_column_text(initial_col1, initial_col2, "   |    ") + "\n\n";
+
+    std::size_t weapons_initial_size; // TODO: make constant
+    WeaponGroups weapons = [&](){
+        std::vector<WeaponInstanceExtended> weapons = prepare_weapons(db, params, set_bonus_subset, cache);
+        weapons_initial_size = weapons.size();
+        if (!weapons_initial_size) throw std::runtime_error("No weapons match the search parameters.");
+        return group_weapons(std::move(weapons));
     }();
-    Utils::log_stat_duration("  >>> Combining seen set initialization: ", start_t);
-    std::clog << "\n";
-    
-    // Seed the seen set with a single empty combination.
-    armour_combos.add({}, {});
-    assert(armour_combos.size() == 1);
 
-    start_t = std::chrono::steady_clock::now();
-    //
-    merge_in_charms(armour_combos, charms, params.skill_spec);
-    //
-    Utils::log_stat("Merged in charms: ", armour_combos.size());
-    Utils::log_stat_duration("  >>> charms merge: ", start_t);
+    // Complete armour combos kept from an earlier search can be reused if nothing they depend on has changed.
+    const bool reuse_armour_stage = options.reuse_armour_combos
+                                    && cache.armour_stage
+                                    && (cache.armour_stage->key == ArmourStage::Key(params));
+    std::unique_ptr<ArmourStage> new_armour_stage;
 
-    // And now, we merge in our slot combinations!
+    auto start_t = std::chrono::steady_clock::now();
 
-    start_t = std::chrono::steady_clock::now();
-    unsigned long long stat_pre = armour_combos.size() * head_combos.size();
-    //
-    merge_in_armour_list(armour_combos, head_combos, set_bonus_subset, params.skill_spec);
-    //
-    Utils::log_stat_reduction("Merged in head+deco  combinations: ", stat_pre, armour_combos.size());
-    Utils::log_stat_duration("  >>> head combo merge: ", start_t);
+    if (reuse_armour_stage) {
+        Utils::log_stat("Reusing armour combos from an earlier search: ", cache.armour_stage->armour_combos.size());
+    } else {
+        cache.armour_stage.reset(); // Frees the old armour combos before we generate new ones.
+        new_armour_stage = std::make_unique<ArmourStage>(db, params, set_bonus_subset);
+    }
+    ArmourStage& armour_stage = reuse_armour_stage ? *cache.armour_stage : *new_armour_stage;
+
+    const SkillLayout&          layout        = armour_stage.layout;
+    DecoComboCache&             deco_cache    = armour_stage.deco_cache;
+    const DecoComboTable&       deco_table    = armour_stage.deco_table;
+    SSBSeenMap<ArmourSetCombo>& armour_combos = armour_stage.armour_combos;
+
+    // Only used if this search merges the armour combos. In merge order.
+    std::vector<const SSBSeenMapSmall<ArmourPieceCombo>*> slot_lists;
+    std::vector<std::string>                              slot_labels; // e.g. "head+deco "
+    std::vector<std::string>                              slot_names;  // e.g. "head"
+
+    Utils::log_stat("Packed skill and set bonus bits: ", layout.get_num_bits());
+
+    // A lower bound for the threshold of the final results, from builds found cheaply before the final merge.
+    // Zero if there's none. (See find_incumbent_threshold().)
+    double incumbent = 0;
+
+    if (!reuse_armour_stage) {
+        Utils::log_stat_duration("  >>> decos, armour slot combos, and combining seen set: ", start_t);
+        Utils::log_stat("Deco combo cache hits:   ", deco_cache.get_stat_hits());
+        Utils::log_stat("Deco combo cache misses: ", deco_cache.get_stat_misses());
+        Utils::log_stat("Distinct armour deco combos: ", deco_table.size());
+        // (The tree size can overflow the int overload.)
+        Utils::log_stat("Combining seen set tree size (bits): "
+                        + std::to_string(armour_combos.get_seen_tree().size())
+                        + (armour_combos.get_seen_tree().uses_dense_storage() ? " (dense)" : " (paged)"));
+        Utils::log_stat();
+
+        // We build the initial build list.
+
+        Utils::log_stat("Threads used for combo merges: ", options.num_threads);
+        if ((options.num_threads > 1) && !SSBConcurrentSeenMap<ArmourSetCombo>::can_hold(armour_combos)) {
+            Utils::log_stat("(The combining seen set tree is too large for a concurrent merge, so combo merges run on "
+                            "the calling thread instead.)");
+        }
 
-    start_t = std::chrono::steady_clock::now();
-    stat_pre = armour_combos.size() * chest_combos.size();
-    //
-    merge_in_armour_list(armour_combos, chest_combos, set_bonus_subset, params.skill_spec);
-    //
-    Utils::log_stat_reduction("Merged in chest+deco combinations: ", stat_pre, armour_combos.size());
-    Utils::log_stat_duration("  >>> chest combo merge: ", start_t);
+        std::vector<const Charm*> charms = prepare_charms(db, params.skill_spec);
+        if (!charms.size()) throw std::runtime_error("There are no charms.");
 
-    start_t = std::chrono::steady_clock::now();
-    stat_pre = armour_combos.size() * arms_combos.size();
-    //
-    merge_in_armour_list(armour_combos, arms_combos, set_bonus_subset, params.skill_spec);
-    //
-    Utils::log_stat_reduction("Merged in arms+deco  combinations: ", stat_pre, armour_combos.size());
-    Utils::log_stat_duration("  >>> arms combo merge: ", start_t);
+        // Seed the seen set with a single empty combination.
+        armour_combos.add({}, {});
+        assert(armour_combos.size() == 1);
 
-    start_t = std::chrono::steady_clock::now();
-    stat_pre = armour_combos.size() * waist_combos.size();
-    //
-    merge_in_armour_list(armour_combos, waist_combos, set_bonus_subset, params.skill_spec);
-    //
-    Utils::log_stat_reduction("Merged in waist+deco combinations: ", stat_pre, armour_combos.size());
-    Utils::log_stat_duration("  >>> waist combo merge: ", start_t);
+        start_t = std::chrono::steady_clock::now();
+        //
+        merge_in_charms(armour_combos, charms, params.skill_spec, layout);
+        //
+        Utils::log_stat("Merged in charms: ", armour_combos.size());
+        Utils::log_stat_duration("  >>> charms merge: ", start_t);
 
-    start_t = std::chrono::steady_clock::now();
-    stat_pre = armour_combos.size() * legs_combos.size();
-    //
-    merge_in_armour_list(armour_combos, legs_combos, set_bonus_subset, params.skill_spec);
-    //
-    Utils::log_stat_reduction("Merged in legs+deco  combinations: ", stat_pre, armour_combos.size());
-    Utils::log_stat_duration("  >>> legs combo merge: ", start_t);
+        // The armour slots are merged in whichever order is estimated to keep partial armour combos fewest.
 
-    double best_total_damage = 0;
+        {
+            const std::vector<const SSBSeenMapSmall<ArmourPieceCombo>*> all_slot_lists = armour_stage.get_slot_lists();
+            const std::vector<std::string> all_slot_names = ArmourStage::get_slot_names();
+            const std::vector<std::size_t> merge_order = plan_merge_order(armour_combos,
+                                                                          all_slot_lists,
+                                                                          armour_stage.seen_map_fields,
+                                                                          layout,
+                                                                          all_slot_names);
+            for (const std::size_t i : merge_order) {
+                const std::string& name = all_slot_names[i];
+                slot_lists.emplace_back(all_slot_lists[i]);
+                slot_labels.emplace_back(name + "+deco" + std::string(5 - std::min<std::size_t>(name.size(), 5), ' '));
+                slot_names.emplace_back(name);
+            }
+        }
+
+        // Builds we can find cheaply give a lower bound for the final results, which prunes weapons and seeds the
+        // final evaluation loop.
+
+        start_t = std::chrono::steady_clock::now();
+        incumbent = find_incumbent_threshold(armour_combos,
+                                             slot_lists,
+                                             weapons,
+                                             deco_cache,
+                                             deco_table,
+                                             params,
+                                             layout,
+                                             options,
+                                             k_INCUMBENT_BEAM_WIDTH);
+        Utils::log_stat("Incumbent threshold: " + std::to_string(incumbent));
+        Utils::log_stat_duration("  >>> incumbent search: ", start_t);
+        std::clog << "\n";
+
+        // And now, we merge in our slot combinations! (All but the last, which is merged further below.)
+
+        for (std::size_t stage = 0; stage + 1 < slot_lists.size(); ++stage) {
+            start_t = std::chrono::steady_clock::now();
+            const unsigned long long stat_pre = armour_combos.size() * slot_lists[stage]->size();
+            //
+            merge_in_armour_list(armour_combos,
+                                 *slot_lists[stage],
+                                 params.skill_spec,
+                                 layout,
+                                 stage,
+                                 options.num_threads);
+            //
+            Utils::log_stat_reduction("Merged in " + slot_labels[stage] + " combinations: ",
+                                      stat_pre,
+                                      armour_combos.size());
+            Utils::log_stat_duration("  >>> " + slot_names[stage] + " combo merge: ", start_t);
+        }
+    }
 
     std::size_t stat_wa_combos_explored = 0;
     std::size_t stat_wad_combos_explored = 0;
-    start_t = std::chrono::steady_clock::now();
+    std::size_t stat_sc_cache_hits = 0;
+    std::size_t stat_sc_cache_misses = 0;
 
-    for (const auto& e : armour_combos) {
-        const SSBTuple&       ac_ssb = e.first;
-        const ArmourSetCombo& ac     = e.second;
-
-        bool reprune_weapons = false;
-        for (const auto& weapon_group_tup : weapons) {
-            const DecoSlots& deco_slots = std::get<0>(weapon_group_tup);
-            const Skill * const skill = std::get<1>(weapon_group_tup);
-            const SetBonus * const setbonus = std::get<2>(weapon_group_tup);
-            const std::vector<WeaponInstanceExtended>& weapon_group = std::get<3>(weapon_group_tup);
-
-            const SetBonusMap wac_set_bonuses = [&](){
-                SetBonusMap x = ac.armour.get_set_bonuses();
-                if (setbonus) x.increment(setbonus, 1);
-                return x;
-            }();
+    std::ofstream results_jsonl;
+    if (options.results_jsonl_path.size()) {
+        results_jsonl.open(options.results_jsonl_path, std::ios::app);
+        if (!results_jsonl) throw std::runtime_error("Failed to open " + options.results_jsonl_path + ".");
+    }
+    std::ostream * const jsonl = results_jsonl.is_open() ? &results_jsonl : nullptr;
+
+    TopBuilds results (options.num_results, options.distinct_weapons);
+    NewBestLogger new_best_logger (params, deco_table, jsonl); // Only used if single-threaded.
+
+    SharedSkillContributionCache sc_cache (params.skill_spec, params.weapon_class);
+    std::size_t ac_index = 0;
+    double pruned_at = 0;
+
+    // Builds below the incumbent can't end up in the results, so weapons that can't reach it are dropped, and
+    // such builds are skipped before they're offered (or logged as new best builds). Weapons that can only
+    // tie the incumbent are kept, since the incumbent's builds must still be found.
+    if (incumbent > 0) {
+        const std::size_t new_weapon_count = prune_weapons(weapons, incumbent, true);
+        Utils::log_stat_reduction("\n\nPruned weapons with incumbent threshold " + std::to_string(incumbent) + ": ",
+                                  weapons_initial_size,
+                                  new_weapon_count);
+    }
 
-            // Filter out anything that exceeds set bonus cutoffs.
-            bool invalid_set_bonuses = false;
-            for (const auto& e : params.skill_spec.get_set_bonus_cutoffs()) {
-                assert(wac_set_bonuses.get(e.first) <= e.second);
-                if (wac_set_bonuses.get(e.first) == e.second) {
-                    invalid_set_bonuses = true;
-                    break;
+    // Only used if multithreaded.
+    std::vector<DecoComboCache> worker_caches;
+    std::vector<SharedSkillContributionCache> worker_sc_caches;
+
+    // Evaluates a container of complete armour combos against weapons, adding to results.
+    const auto evaluate_armour_combos = [&](const auto& complete_combos){
+        const auto ac_vec = order_best_first(complete_combos, weapons, params, layout);
+
+        if (options.num_threads > 1) {
+            if (worker_caches.empty()) {
+                worker_caches.reserve(options.num_threads);
+                worker_sc_caches.reserve(options.num_threads);
+                for (std::size_t i = 0; i < options.num_threads; ++i) {
+                    worker_caches.emplace_back(deco_cache.fork());
+                    worker_sc_caches.emplace_back(params.skill_spec, params.weapon_class);
                 }
             }
-            if (invalid_set_bonuses) {
-                continue;
+            const TopBuilds chunk_results = find_top_builds_multithreaded(ac_vec,
+                                                                          ac_index,
+                                                                          std::max(results.threshold(), incumbent),
+                                                                          weapons,
+                                                                          worker_caches,
+                                                                          worker_sc_caches,
+                                                                          deco_table,
+                                                                          params,
+                                                                          layout,
+                                                                          options,
+                                                                          stat_wa_combos_explored,
+                                                                          stat_wad_combos_explored);
+            for (FoundBuild& b : chunk_results.get_sorted()) {
+                results.try_add(std::move(b));
             }
+            ac_index += ac_vec.size();
 
-            // wac_skills includes all set bonus skills.
-            const SkillMap wac_skills = [&](){
-                SkillMap x = std::get<0>(ac_ssb); // "Weapon-armour-combo"
-                x.add_set_bonuses(wac_set_bonuses);
-                if (skill) x.increment(skill, 1);
-                return x;
-            }();
-            
-            std::vector<std::vector<const Decoration*>> w_decos = generate_deco_combos(deco_slots,
-                                                                                       grouped_sorted_decos,
-                                                                                       params.skill_spec,
-                                                                                       wac_skills);
-            for (std::vector<const Decoration*>& dc : w_decos) {
-
-                const SkillMap skills = [&](){
-                    SkillMap x = wac_skills;
-                    x.merge_in(dc);
-                    return x;
-                }();
+            // Later armour combos rank lower on ties, so only weapons that can beat the threshold are needed.
+            if (results.threshold() > pruned_at) {
+                pruned_at = results.threshold();
+                refilter_weapons(weapons, pruned_at, weapons_initial_size);
+            }
+        } else {
+            const auto on_new_best = [&](const FoundBuild& x, const std::vector<const Decoration*>& weapon_decos){
+                new_best_logger.add(x, weapon_decos);
+            };
 
-                // Filter out anything that doesn't meet minimum requirements
-                if (!params.skill_spec.skills_meet_minimum_requirements(skills)) continue;
+            for (const auto * const e : ac_vec) {
+                evaluate_armour_combo(e->first,
+                                      e->second,
+                                      ac_index++,
+                                      weapons,
+                                      deco_cache,
+                                      sc_cache,
+                                      deco_table,
+                                      params,
+                                      layout,
+                                      incumbent,
+                                      results,
+                                      on_new_best,
+                                      stat_wa_combos_explored,
+                                      stat_wad_combos_explored);
+                if (results.threshold() > pruned_at) {
+                    pruned_at = results.threshold();
+                    // Logged in order with the new best builds.
+                    const std::size_t new_weapon_count = prune_weapons(weapons, pruned_at, false);
+                    new_best_logger.add_log([=, threshold = pruned_at](){
+                        log_refilter(threshold, weapons_initial_size, new_weapon_count);
+                    });
+                }
+            }
+        }
+    };
 
-                ++stat_wa_combos_explored;
-                stat_wad_combos_explored += weapon_group.size();
+    if (reuse_armour_stage) {
+        start_t = std::chrono::steady_clock::now();
+        evaluate_armour_combos(armour_combos);
+    } else {
+        const std::size_t last_stage = slot_lists.size() - 1;
+        const SSBSeenMapSmall<ArmourPieceCombo>& last_combos = *slot_lists[last_stage];
+
+        const std::size_t merge_chunk_size = get_merge_chunk_size(armour_combos, last_combos, options);
+
+        start_t = std::chrono::steady_clock::now();
+        unsigned long long stat_pre = armour_combos.size() * last_combos.size();
+
+        if (!merge_chunk_size) {
+            //
+            merge_in_armour_list(armour_combos,
+                                 last_combos,
+                                 params.skill_spec,
+                                 layout,
+                                 last_stage,
+                                 options.num_threads);
+            //
+            Utils::log_stat_reduction("Merged in " + slot_labels[last_stage] + " combinations: ",
+                                      stat_pre,
+                                      armour_combos.size());
+            Utils::log_stat_duration("  >>> " + slot_names[last_stage] + " combo merge: ", start_t);
+
+            if (options.reuse_armour_combos) {
+                cache.armour_stage = std::move(new_armour_stage);
+                Utils::log_stat("Armour combos kept for reuse by later searches.");
+            }
 
-                for (const WeaponInstanceExtended& wc : weapon_group) {
+            start_t = std::chrono::steady_clock::now();
+            evaluate_armour_combos(armour_combos);
+        } else {
+            // The merged combos might not fit in the memory budget all at once, so we merge in chunks of previous
+            // combos, and evaluate and discard each chunk's combos before moving onto the next.
+            //
+            // All chunks share one seen tree, so combos that are subsets of combos from earlier chunks are still
+            // rejected. However, combos from earlier chunks have already been evaluated by the time a later chunk
+            // could prune them. This doesn't change the best build found, but lower-ranked results could include
+            // such builds, which is why a memory budget is only allowed when searching for one build.
+            assert(options.num_results == 1);
+            Utils::log_stat("Final armour merge is split into chunks of previous combos: ", merge_chunk_size);
+
+            std::size_t stat_merged = 0;
+            std::size_t stat_chunks = 0;
+            SSBSeenMap<ArmourSetCombo> merged_combos = armour_combos.clone_empty();
+
+            // The previous combos are moved into each chunk, and then into the chunk's merged combos, so each one
+            // is only ever held once.
+            auto prev_generation = armour_combos.take_generation();
+            decltype(prev_generation) prev_chunk;
+            std::vector<ArmourComboRef> prev_chunk_refs;
+            for (std::size_t lo = 0; lo < prev_generation.size(); lo += merge_chunk_size) {
+                const std::size_t hi = std::min(lo + merge_chunk_size, prev_generation.size());
+                prev_chunk.clear();
+                prev_chunk_refs.clear();
+                for (std::size_t i = lo; i < hi; ++i) {
+                    prev_chunk.emplace_back(std::move(prev_generation[i]));
+                    // Entries stay where they are when their node handles are moved.
+                    prev_chunk_refs.push_back({&prev_chunk.back().key(), &prev_chunk.back().mapped()});
+                }
 
-                    assert((!params.health_regen_required) || wc.contributions.health_regen_active);
+                // The previous combos are kept unless a merged combo replaces them, the same as merging in place.
+                // Those already replaced by combos of earlier chunks are still merged, but aren't kept.
+                const std::size_t num_kept = merged_combos.mark_generation(prev_chunk);
+                merge_armour_list_into(merged_combos,
+                                       prev_chunk_refs,
+                                       last_combos,
+                                       params.skill_spec,
+                                       layout,
+                                       last_stage,
+                                       options.num_threads);
+                prev_chunk.erase(prev_chunk.begin() + num_kept, prev_chunk.end());
+                merged_combos.restore_generation(std::move(prev_chunk));
+                const std::vector<ArmourComboEntry> chunk_combos = merged_combos.take_data();
+                stat_merged += chunk_combos.size();
+                ++stat_chunks;
+
+                evaluate_armour_combos(chunk_combos);
+            }
 
-                    const EffectiveDamageValues edv = calculate_edv_from_skills_lookup(wc.instance.weapon->weapon_class,
-                                                                                       wc.contributions,
-                                                                                       skills,
-                                                                                       params.misc_buffs,
-                                                                                       params.skill_spec);
-                    const ModelCalculatedValues mcv = calculate_damage(params.damage_model, edv);
-                    const double total_damage = mcv.unrounded_total_damage;
-
-                    if (total_damage > best_total_damage) {
-                        best_total_damage = total_damage;
-
-                        const DecoEquips curr_decos = [&](){
-                            DecoEquips x = std::move(dc);
-                            x.merge_in(ac.decos);
-                            assert(x.fits_in(ac.armour, wc.contributions));
-                            return x;
-                        }();
-
-                        const std::string col1 = wc.instance.weapon->name + "\n\n"
-                                                 + wc.instance.upgrades->get_humanreadable() + "\n\n"
-                                                 + wc.instance.augments->get_humanreadable() + "\n\n"
-                                                 + "Armour:\n"
-                                                 + Utils::indent(ac.armour.get_humanreadable(), 4) + "\n\n"
-                                                 + "Decorations:\n"
-                                                 + Utils::indent(curr_decos.get_humanreadable(), 4) + "\n\n"
-                                                 + "Buffs:\n"
-                                                 + Utils::indent(params.misc_buffs.get_humanreadable(), 4);
-
-                        const std::string col2 = "Skills:\n"
-                                                 + Utils::indent(skills.get_humanreadable(), 4) + "\n\n"
-                                                 + "Effective Damage Values:\n"
-                                                 + Utils::indent(edv.get_humanreadable(), 4) + "\n\n"
-                                                 + "Model Damage Values:\n"
-                                                 + Utils::indent(mcv.get_humanreadable(), 4);
-
-                        std::clog << "\n\nFound Total Damage: " + std::to_string(best_total_damage) + "\n\n"
-                                  << Utils::indent(Utils::two_column_text(col1, col2, "   |   "), 4) + "\n";
-
-                        reprune_weapons = true;
-                    }
+            new_best_logger.finish(); // Before logging anything else. (See NewBestLogger.)
+            Utils::log_stat("Final armour merge chunks: ", stat_chunks);
+            Utils::log_stat_reduction("Merged in " + slot_labels[last_stage] + " combinations: ", stat_pre, stat_merged);
+            Utils::log_stat("(The final armour merge is timed together with the weapon combo merge.)");
+            if (options.reuse_armour_combos) {
+                Utils::log_stat("Armour combos exceed the memory budget, so they won't be kept for reuse.");
+            }
+        }
+    }
 
-                }
+    stat_sc_cache_hits = sc_cache.get_stat_hits();
+    stat_sc_cache_misses = sc_cache.get_stat_misses();
+    for (std::size_t i = 0; i < worker_caches.size(); ++i) {
+        deco_cache.add_stats(worker_caches[i]);
+        stat_sc_cache_hits += worker_sc_caches[i].get_stat_hits();
+        stat_sc_cache_misses += worker_sc_caches[i].get_stat_misses();
+    }
 
-            }
+    new_best_logger.finish();
 
+    const std::vector<FoundBuild> sorted_results = results.get_sorted();
+    if (jsonl) {
+        for (std::size_t i = 0; i < sorted_results.size(); ++i) {
+            nlohmann::json j = found_build_to_json(sorted_results[i]);
+            j["event"] = "result";
+            j["rank"] = i + 1;
+            *jsonl << j.dump() + "\n";
         }
-        if (reprune_weapons) refilter_weapons(weapons, best_total_damage, weapons_initial_size);
+        jsonl->flush();
     }
+    on_results(sorted_results);
 
     Utils::log_stat_expansion("\nWeapon-armour --> +decos combinations explored: ",
                               stat_wa_combos_explored,
                               stat_wad_combos_explored);
+    Utils::log_stat("Deco combo cache hits (total):   ", deco_cache.get_stat_hits());
+    Utils::log_stat("Deco combo cache misses (total): ", deco_cache.get_stat_misses());
+    Utils::log_stat("Skill contribution cache hits:   ", stat_sc_cache_hits);
+    Utils::log_stat("Skill contribution cache misses: ", stat_sc_cache_misses);
     Utils::log_stat_duration("  >>> weapon combo merge: ", start_t);
     Utils::log_stat();
 
@@ -1014,12 +2641,41 @@ static void do_search(const Database& db, const SearchParameters& params) {
 }
 
 
-void search_cmd(const std::string& search_parameters_path) {
+void search_cmd(const std::string& search_parameters_path, const SearchOptions& options) {
 
     const Database db = Database::get_db();
     const SearchParameters params = read_file(search_parameters_path);
+    SearchCache cache;
+
+    const auto on_results = [&](const std::vector<FoundBuild>& sorted_results){
+        // A single-threaded search for one build already logged it as soon as it was found.
+        if ((options.num_threads == 1) && (options.num_results == 1)) return;
+        log_ranked_builds(sorted_results, params, options, std::clog);
+    };
+    do_search(db, params, options, cache, on_results);
+}
+
+
+void serve_cmd(const SearchOptions& options) {
+
+    const Database db = Database::get_db();
+    SearchCache cache;
 
-    do_search(db, params);
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+
+        try {
+            const SearchParameters params = read_json_str(line);
+            const auto on_results = [&](const std::vector<FoundBuild>& sorted_results){
+                log_ranked_builds(sorted_results, params, options, std::cout);
+            };
+            do_search(db, params, options, cache, on_results);
+        } catch (const std::exception& e) {
+            std::cout << "\nERROR " << e.what() << "\n";
+        }
+        std::cout << "\nEND" << std::endl;
+    }
 }
 
 
@@ -25,19 +25,19 @@ static SearchParameters read_json_obj(const nlohmann::json& j) {
         throw std::runtime_error("Expected JSON object.");
     }
 
-    const bool allow_low_rank        = j["allow_low_rank"];
-    const bool allow_high_rank       = j["allow_high_rank"];
-    const bool allow_master_rank     = j["allow_master_rank"];
+    const bool allow_low_rank        = j.at("allow_low_rank");
+    const bool allow_high_rank       = j.at("allow_high_rank");
+    const bool allow_master_rank     = j.at("allow_master_rank");
 
-    WeaponClass weapon_class = upper_snake_case_to_weaponclass(j["weapon_selection"]["class"]);
+    WeaponClass weapon_class = upper_snake_case_to_weaponclass(j.at("weapon_selection").at("class"));
     std::unordered_set<EleStatType> allowed_weapon_elestat_types = [&](){
-        const bool allow_fire    = j["weapon_selection"]["allow_fire"   ];
-        const bool allow_water   = j["weapon_selection"]["allow_water"  ];
-        const bool allow_thunder = j["weapon_selection"]["allow_thunder"];
-        const bool allow_ice     = j["weapon_selection"]["allow_ice"    ];
-        const bool allow_dragon  = j["weapon_selection"]["allow_dragon" ];
-        const bool allow_poison  = j["weapon_selection"]["allow_poison" ];
-        const bool allow_blast   = j["weapon_selection"]["allow_blast"  ];
+        const bool allow_fire    = j.at("weapon_selection").at("allow_fire"   );
+        const bool allow_water   = j.at("weapon_selection").at("allow_water"  );
+        const bool allow_thunder = j.at("weapon_selection").at("allow_thunder");
+        const bool allow_ice     = j.at("weapon_selection").at("allow_ice"    );
+        const bool allow_dragon  = j.at("weapon_selection").at("allow_dragon" );
+        const bool allow_poison  = j.at("weapon_selection").at("allow_poison" );
+        const bool allow_blast   = j.at("weapon_selection").at("allow_blast"  );
 
         std::unordered_set<EleStatType> x;
         if (allow_fire)    x.emplace(EleStatType::fire   );
@@ -49,29 +49,29 @@ static SearchParameters read_json_obj(const nlohmann::json& j) {
         if (allow_blast)   x.emplace(EleStatType::blast  );
         return x;
     }();
-    const bool health_regen_required = j["weapon_selection"]["health_regen_required"];
+    const bool health_regen_required = j.at("weapon_selection").at("health_regen_required");
 
     DamageModel damage_model = [&](){
-        const unsigned int raw_motion_value   = j["damage_model"]["raw_motion_value"  ];
-        const double       elemental_modifier = j["damage_model"]["elemental_modifier"];
-        const double       status_modifier    = j["damage_model"]["status_modifier"   ];
+        const unsigned int raw_motion_value   = j.at("damage_model").at("raw_motion_value"  );
+        const double       elemental_modifier = j.at("damage_model").at("elemental_modifier");
+        const double       status_modifier    = j.at("damage_model").at("status_modifier"   );
 
-        const unsigned int hzv_raw     = j["damage_model"]["hzv_raw"    ];
-        const unsigned int hzv_fire    = j["damage_model"]["hzv_fire"   ];
-        const unsigned int hzv_water   = j["damage_model"]["hzv_water"  ];
-        const unsigned int hzv_thunder = j["damage_model"]["hzv_thunder"];
-        const unsigned int hzv_ice     = j["damage_model"]["hzv_ice"    ];
-        const unsigned int hzv_dragon  = j["damage_model"]["hzv_dragon" ];
+        const unsigned int hzv_raw     = j.at("damage_model").at("hzv_raw"    );
+        const unsigned int hzv_fire    = j.at("damage_model").at("hzv_fire"   );
+        const unsigned int hzv_water   = j.at("damage_model").at("hzv_water"  );
+        const unsigned int hzv_thunder = j.at("damage_model").at("hzv_thunder");
+        const unsigned int hzv_ice     = j.at("damage_model").at("hzv_ice"    );
+        const unsigned int hzv_dragon  = j.at("damage_model").at("hzv_dragon" );
 
-        const double       poison_total_procs = j["damage_model"]["poison_total_procs_per_quest"];
-        const unsigned int poison_proc_dmg    = j["damage_model"]["poison_proc_dmg"             ];
+        const double       poison_total_procs = j.at("damage_model").at("poison_total_procs_per_quest");
+        const unsigned int poison_proc_dmg    = j.at("damage_model").at("poison_proc_dmg"             );
 
-        unsigned int blast_base     = j["damage_model"]["blast_base"    ];
-        unsigned int blast_buildup  = j["damage_model"]["blast_buildup" ];
-        unsigned int blast_cap      = j["damage_model"]["blast_cap"     ];
-        unsigned int blast_proc_dmg = j["damage_model"]["blast_proc_dmg"];
+        unsigned int blast_base     = j.at("damage_model").at("blast_base"    );
+        unsigned int blast_buildup  = j.at("damage_model").at("blast_buildup" );
+        unsigned int blast_cap      = j.at("damage_model").at("blast_cap"     );
+        unsigned int blast_proc_dmg = j.at("damage_model").at("blast_proc_dmg");
 
-        unsigned int target_health = j["damage_model"]["target_health"];
+        unsigned int target_health = j.at("damage_model").at("target_health");
 
         DamageModel x = {raw_motion_value,
                          elemental_modifier,
@@ -99,7 +99,7 @@ static SearchParameters read_json_obj(const nlohmann::json& j) {
 
     std::unordered_map<const Skill*, unsigned int> min_levels = [&](){
         std::unordered_map<const Skill*, unsigned int> ret;
-        for (auto& e : j["selected_skills"].items()) {
+        for (auto& e : j.at("selected_skills").items()) {
             ret.insert({SkillsDatabase::get_skill(e.key()), e.value()});
         }
         return ret;
@@ -107,7 +107,7 @@ static SearchParameters read_json_obj(const nlohmann::json& j) {
 
     std::unordered_map<const Skill*, unsigned int> states = [&](){
         std::unordered_map<const Skill*, unsigned int> ret;
-        for (auto& e : j["forced_skill_states"].items()) {
+        for (auto& e : j.at("forced_skill_states").items()) {
             ret.insert({SkillsDatabase::get_skill(e.key()), e.value()});
         }
         return ret;
@@ -115,7 +115,7 @@ static SearchParameters read_json_obj(const nlohmann::json& j) {
 
     std::unordered_set<const Skill*> force_remove_skill = [&](){
         std::unordered_set<const Skill*> ret;
-        nlohmann::json j2 = j["force_remove_skills"];
+        nlohmann::json j2 = j.at("force_remove_skills");
         if (!j2.is_array()) {
             throw std::runtime_error("'force_remove_skills' must be an array of strings.");
         }
@@ -137,7 +137,7 @@ static SearchParameters read_json_obj(const nlohmann::json& j) {
     // Now, we determine miscellaneous buffs here.
     std::unordered_set<const MiscBuff*> miscbuffs;
     {
-        nlohmann::json j2 = j["misc_buffs"];
+        nlohmann::json j2 = j.at("misc_buffs");
         if (!j2.is_array()) {
             throw std::runtime_error("'misc_buffs' must be an array of strings.");
         }
@@ -175,5 +175,10 @@ SearchParameters read_file(const std::string& filepath) {
 }
 
 
+SearchParameters read_json_str(const std::string& json_str) {
+    return read_json_obj(nlohmann::json::parse(json_str));
+}
+
+
 } // namespace
 
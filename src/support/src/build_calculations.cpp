@@ -4,6 +4,7 @@
  */
 
 #include <assert.h>
+#include <algorithm>
 #include <stdexcept>
 #include <cmath>
 
@@ -25,6 +26,44 @@ static constexpr double k_NORMAL_STATUS_APPL_PROBABILITY = 1.0/3;
 static constexpr double k_RAW_BLUNDER_MULTIPLIER = 0.75;
 
 
+// Shared by calculate_edv() and WeaponBatch so that both produce the same results.
+static double calculate_raw_crit_modifier(const int affinity, const double raw_crit_dmg_multiplier) noexcept {
+    //double raw_crit_chance = std::clamp(((double) (weapon_aff + added_aff)) / 100, -1.0, 1.0); // Could be better
+    double raw_crit_chance = ((double) affinity) / 100;
+    if (raw_crit_chance < 0) {
+        double raw_blunder_chance = (raw_crit_chance < -1.0) ? -1.0 : -raw_crit_chance;
+        return (k_RAW_BLUNDER_MULTIPLIER * raw_blunder_chance) + (1 - raw_blunder_chance);
+    } else {
+        raw_crit_chance = (raw_crit_chance > 1.0) ? 1.0 : raw_crit_chance;
+        return (raw_crit_dmg_multiplier * raw_crit_chance) + (1 - raw_crit_chance);
+    }
+}
+
+
+// Shared by calculate_edv() and WeaponBatch so that both produce the same results.
+static unsigned int calculate_precap_true_raw(const unsigned int weapon_raw,
+                                              const unsigned int bludgeoner_added_raw,
+                                              const double       base_raw_multiplier,
+                                              const unsigned int added_raw) noexcept {
+    const double weapon_multiplied_raw = (weapon_raw + bludgeoner_added_raw) * base_raw_multiplier;
+    return std::round(weapon_multiplied_raw) + added_raw;
+}
+
+
+// Shared by calculate_edv() and WeaponBatch so that both produce the same results.
+static double calculate_base_elestat_value(const EleStatVisibility weapon_elestat_visibility,
+                                           const double            weapon_elestat_value,
+                                           const unsigned int      free_element_active_percentage) noexcept {
+    if (weapon_elestat_visibility == EleStatVisibility::hidden) {
+        return (weapon_elestat_value * ((double)free_element_active_percentage)) / 100;
+    } else {
+        assert((weapon_elestat_visibility == EleStatVisibility::open)
+               || ((weapon_elestat_visibility == EleStatVisibility::none) && (!weapon_elestat_value)));
+        return weapon_elestat_value;
+    }
+}
+
+
 static EffectiveDamageValues calculate_edv(const unsigned int    weapon_raw, // True raw, not bloated raw.
                                            const int             weapon_aff,
 
@@ -48,17 +87,7 @@ static EffectiveDamageValues calculate_edv(const unsigned int    weapon_raw, //
 
     const int affinity = weapon_aff + added_aff;
 
-    const double raw_crit_modifier = [&](){
-        //double raw_crit_chance = std::clamp(((double) (weapon_aff + added_aff)) / 100, -1.0, 1.0); // Could be better
-        double raw_crit_chance = ((double) affinity) / 100;
-        if (raw_crit_chance < 0) {
-            double raw_blunder_chance = (raw_crit_chance < -1.0) ? -1.0 : -raw_crit_chance;
-            return (k_RAW_BLUNDER_MULTIPLIER * raw_blunder_chance) + (1 - raw_blunder_chance);
-        } else {
-            raw_crit_chance = (raw_crit_chance > 1.0) ? 1.0 : raw_crit_chance;
-            return (raw_crit_dmg_multiplier * raw_crit_chance) + (1 - raw_crit_chance);
-        }
-    }();
+    const double raw_crit_modifier = calculate_raw_crit_modifier(affinity, raw_crit_dmg_multiplier);
 
     /*
      * Effective Raw
@@ -68,8 +97,10 @@ static EffectiveDamageValues calculate_edv(const unsigned int    weapon_raw, //
 
     const unsigned int raw_cap = weapon_raw * k_RAW_CAP;
 
-    const double weapon_multiplied_raw = (weapon_raw + bludgeoner_added_raw) * base_raw_multiplier;
-    const unsigned int precap_true_raw = std::round(weapon_multiplied_raw) + added_raw;
+    const unsigned int precap_true_raw = calculate_precap_true_raw(weapon_raw,
+                                                                   bludgeoner_added_raw,
+                                                                   base_raw_multiplier,
+                                                                   added_raw);
     const unsigned int postcap_true_raw = std::min(precap_true_raw, raw_cap);
     
     const double efr = postcap_true_raw * raw_crit_modifier * raw_sharpness_modifier * frostcraft_raw_multiplier;
@@ -92,15 +123,9 @@ static EffectiveDamageValues calculate_edv(const unsigned int    weapon_raw, //
         }
     }();
 
-    const double base_elestat_value = [&](){
-        if (weapon_elestat_visibility == EleStatVisibility::hidden) {
-            return (weapon_elestat_value * ((double)free_element_active_percentage)) / 100;
-        } else {
-            assert((weapon_elestat_visibility == EleStatVisibility::open)
-                   || ((weapon_elestat_visibility == EleStatVisibility::none) && (!weapon_elestat_value)));
-            return weapon_elestat_value;
-        }
-    }();
+    const double base_elestat_value = calculate_base_elestat_value(weapon_elestat_visibility,
+                                                                   weapon_elestat_value,
+                                                                   free_element_active_percentage);
 
     // TODO: The rounding is accurate for elemental, but idk about status.
     //       Although, it just happens to be ok for status since I haven't
@@ -182,7 +207,7 @@ static double calculate_poison_damage(const DamageModel& md,
 
 // raw_damage_per_iter can be raw damage per hit
 static double calculate_blast_damage(const DamageModel& md,
-                                     const EffectiveDamageValues& edv,
+                                     const double efes,
                                      const double raw_damage_per_iter) {
 
     // The variable names here will reflect the variable names used in the blast damage model document
@@ -190,13 +215,13 @@ static double calculate_blast_damage(const DamageModel& md,
 
     // This implementation is the simplified "continuous model".
 
-    if (!edv.efes) {
+    if (!efes) {
         return 0.0; // Zero blast damage because we never build status
     }
 
     // Player attack parameters
     const double rho   = raw_damage_per_iter;
-    const double sigma = edv.efes * md.status_modifier;
+    const double sigma = efes * md.status_modifier;
     assert(rho);
     assert(sigma);
 
@@ -243,44 +268,59 @@ static double calculate_blast_damage(const DamageModel& md,
 }
 
 
+// Shared by calculate_damage() and WeaponBatch so that both produce the same results.
+static double calculate_unrounded_raw_damage(const DamageModel& model, const double efr) noexcept {
+    return (efr / 100) * (double) model.raw_motion_value * ((double) model.hzv_raw / 100);
+}
+
+
+// Shared by calculate_damage() and WeaponBatch so that both produce the same results.
+static double calculate_unrounded_elestat_damage(const DamageModel& model,
+                                                 const double       efes,
+                                                 const EleStatType  elestat_type,
+                                                 const double       unrounded_raw_damage) {
+    if (efes == 0) {
+        return 0.0; // Zero EFE/EFS always means zero damage.
+    } else if (elestattype_is_element(elestat_type)) {
+        assert(elestat_type != EleStatType::none);
+        const double ele_hzv = [&](){
+            switch (elestat_type) {
+                case EleStatType::fire:    return (double) model.hzv_fire    / 100;
+                case EleStatType::water:   return (double) model.hzv_water   / 100;
+                case EleStatType::thunder: return (double) model.hzv_thunder / 100;
+                case EleStatType::ice:     return (double) model.hzv_ice     / 100;
+                case EleStatType::dragon:  return (double) model.hzv_dragon  / 100;
+                default:
+                    throw std::logic_error("Unexpected EleStatType value. Expected an elemental.");
+            }
+        }();
+        return model.elemental_modifier * efes * ele_hzv;
+    } else {
+        switch (elestat_type) {
+            case EleStatType::poison:
+                return calculate_poison_damage(model, unrounded_raw_damage);
+            case EleStatType::paralysis:
+            case EleStatType::sleep:
+                return 0.0; // Sleep and paralysis do no damage.
+            case EleStatType::blast:
+                return calculate_blast_damage(model, efes, unrounded_raw_damage);
+            default:
+                throw std::logic_error("Unexpected EleStatType value. Expected a status.");
+        }
+    }
+}
+
+
 // TODO: Implement the special rounding function that implements special handling of values between
 //       -1.0 and 1.0 to always round away from zero.
 ModelCalculatedValues calculate_damage(const DamageModel& model,
                                        const EffectiveDamageValues& edv) {
 
-    const double unrounded_raw_damage = (edv.efr / 100) * (double) model.raw_motion_value * ((double) model.hzv_raw / 100);
-
-    const double unrounded_elestat_damage = [&](){
-        if (edv.efes == 0) {
-            return 0.0; // Zero EFE/EFS always means zero damage.
-        } else if (elestattype_is_element(edv.elestat_type)) {
-            assert(edv.elestat_type != EleStatType::none);
-            const double ele_hzv = [&](){
-                switch (edv.elestat_type) {
-                    case EleStatType::fire:    return (double) model.hzv_fire    / 100;
-                    case EleStatType::water:   return (double) model.hzv_water   / 100;
-                    case EleStatType::thunder: return (double) model.hzv_thunder / 100;
-                    case EleStatType::ice:     return (double) model.hzv_ice     / 100;
-                    case EleStatType::dragon:  return (double) model.hzv_dragon  / 100;
-                    default:
-                        throw std::logic_error("Unexpected EleStatType value. Expected an elemental.");
-                }
-            }();
-            return model.elemental_modifier * edv.efes * ele_hzv;
-        } else {
-            switch (edv.elestat_type) {
-                case EleStatType::poison:
-                    return calculate_poison_damage(model, unrounded_raw_damage);
-                case EleStatType::paralysis:
-                case EleStatType::sleep:
-                    return 0.0; // Sleep and paralysis do no damage.
-                case EleStatType::blast:
-                    return calculate_blast_damage(model, edv, unrounded_raw_damage);
-                default:
-                    throw std::logic_error("Unexpected EleStatType value. Expected a status.");
-            }
-        }
-    }();
+    const double unrounded_raw_damage = calculate_unrounded_raw_damage(model, edv.efr);
+    const double unrounded_elestat_damage = calculate_unrounded_elestat_damage(model,
+                                                                               edv.efes,
+                                                                               edv.elestat_type,
+                                                                               unrounded_raw_damage);
 
     assert(unrounded_raw_damage >= 0.0);
     assert(unrounded_elestat_damage >= 0.0);
@@ -297,6 +337,109 @@ ModelCalculatedValues calculate_damage(const DamageModel& model,
 }
 
 
+WeaponBatch::WeaponBatch(const WeaponClass new_weapon_class) noexcept
+    : weapon_class                 (new_weapon_class)
+    , weapon_raw                   ()
+    , weapon_aff                   ()
+    , elestat_visibility           ()
+    , elestat_type                 ()
+    , elestat_value                ()
+    , raw_sharpness_modifier       (SkillsDatabase::g_skill_handicraft.secret_limit + 1)
+    , elemental_sharpness_modifier (SkillsDatabase::g_skill_handicraft.secret_limit + 1)
+    , bludgeoner_added_raw         (SkillsDatabase::g_skill_handicraft.secret_limit + 1)
+{
+}
+
+
+void WeaponBatch::push_back(const WeaponContribution& wc) {
+    assert(wc.weapon_raw > 0);
+
+    for (unsigned int lvl = 0; lvl < this->raw_sharpness_modifier.size(); ++lvl) {
+        const SharpnessGauge gauge = wc.is_constant_sharpness
+                                     ? wc.maximum_sharpness
+                                     : wc.maximum_sharpness.apply_handicraft(lvl);
+        this->raw_sharpness_modifier[lvl].emplace_back(gauge.get_raw_sharpness_modifier());
+        this->elemental_sharpness_modifier[lvl].emplace_back(gauge.get_elemental_sharpness_modifier());
+        this->bludgeoner_added_raw[lvl].emplace_back(
+                SkillContribution::calculate_bludgeoner_added_raw(gauge.get_sharpness_level()));
+    }
+
+    this->weapon_raw.emplace_back(wc.weapon_raw);
+    this->weapon_aff.emplace_back(wc.weapon_aff);
+    this->elestat_visibility.emplace_back(wc.elestat_visibility);
+    this->elestat_type.emplace_back(wc.elestat_type);
+    this->elestat_value.emplace_back(wc.elestat_value);
+}
+
+
+std::size_t WeaponBatch::size() const noexcept {
+    return this->weapon_raw.size();
+}
+
+
+void WeaponBatch::calculate_total_damage(const SkillMap&        skills,
+                                         const MiscBuffsEquips& misc_buffs,
+                                         const SkillSpec&       skill_spec,
+                                         const DamageModel&     model,
+                                         std::vector<double>&   out) const {
+    const SharedSkillContribution sc(skills, skill_spec, this->weapon_class);
+    this->calculate_total_damage(sc, misc_buffs, model, out);
+}
+
+
+void WeaponBatch::calculate_total_damage(const SharedSkillContribution& sc,
+                                         const MiscBuffsEquips&         misc_buffs,
+                                         const DamageModel&             model,
+                                         std::vector<double>&           out) const {
+    const std::size_t n = this->size();
+    out.resize(n);
+    if (!n) return;
+
+    assert(sc.handicraft_lvl <= SkillsDatabase::g_skill_handicraft.secret_limit);
+    assert(sc.raw_crit_dmg_multiplier > 0.0);
+
+    // Non-elemental Boost only depends on whether the element is open, so there are only two values.
+    const double base_raw_multiplier_open = sc.get_base_raw_multiplier(EleStatVisibility::open)
+                                            * misc_buffs.get_base_raw_multiplier();
+    const double base_raw_multiplier_other = sc.get_base_raw_multiplier(EleStatVisibility::hidden)
+                                             * misc_buffs.get_base_raw_multiplier();
+    const unsigned int added_raw = sc.added_raw + misc_buffs.get_added_raw();
+
+    const std::vector<double>& raw_sharpness = this->raw_sharpness_modifier[sc.handicraft_lvl];
+    const std::vector<double>& ele_sharpness = this->elemental_sharpness_modifier[sc.handicraft_lvl];
+    const std::vector<unsigned int>& bludgeoner = this->bludgeoner_added_raw[sc.handicraft_lvl];
+
+    // First pass: Raw damage. This is branch-light and runs over contiguous arrays.
+    for (std::size_t i = 0; i < n; ++i) {
+        const double raw_crit_modifier = calculate_raw_crit_modifier(this->weapon_aff[i] + sc.added_aff,
+                                                                     sc.raw_crit_dmg_multiplier);
+        const double base_raw_multiplier = (this->elestat_visibility[i] == EleStatVisibility::open)
+                                           ? base_raw_multiplier_open
+                                           : base_raw_multiplier_other;
+        const unsigned int precap_true_raw = calculate_precap_true_raw(this->weapon_raw[i],
+                                                                       sc.bludgeoner_active ? bludgeoner[i] : 0,
+                                                                       base_raw_multiplier,
+                                                                       added_raw);
+        const unsigned int postcap_true_raw = std::min(precap_true_raw, this->weapon_raw[i] * k_RAW_CAP);
+        const double efr = postcap_true_raw * raw_crit_modifier * raw_sharpness[i] * sc.frostcraft_raw_multiplier;
+        out[i] = calculate_unrounded_raw_damage(model, efr);
+    }
+
+    // Second pass: Element/status damage.
+    for (std::size_t i = 0; i < n; ++i) {
+        if (this->elestat_visibility[i] == EleStatVisibility::none) continue;
+        const double elestat_combined_postround_modifier = elestattype_is_element(this->elestat_type[i])
+                                                           ? ele_sharpness[i]
+                                                           : k_NORMAL_STATUS_APPL_PROBABILITY;
+        const double base_elestat_value = calculate_base_elestat_value(this->elestat_visibility[i],
+                                                                       this->elestat_value[i],
+                                                                       sc.free_element_active_percentage);
+        const double efes = std::round(base_elestat_value) * elestat_combined_postround_modifier;
+        out[i] += calculate_unrounded_elestat_damage(model, efes, this->elestat_type[i], out[i]);
+    }
+}
+
+
 std::string DamageModel::get_humanreadable() const {
     return "Raw Motion Value:   " + std::to_string(this->raw_motion_value)
            + "\nElemental Modifier: " + std::to_string(this->elemental_modifier)
@@ -56,6 +56,16 @@ bool ArmourEquips::charm_slot_is_filled() const {
 }
 
 
+const ArmourPiece* ArmourEquips::get_piece(const ArmourSlot& slot) const {
+    return this->data[slot_to_index(slot)];
+}
+
+
+const Charm* ArmourEquips::get_charm() const {
+    return this->charm;
+}
+
+
 SkillMap ArmourEquips::get_skills_without_set_bonuses() const {
     SkillMap ret;
     for (const ArmourPiece * const & armour_piece : this->data) {
@@ -5,6 +5,7 @@
 
 #include <assert.h>
 #include <algorithm>
+#include <cstring>
 
 #include "../support.h"
 #include "../../utils/utils.h"
@@ -15,6 +16,15 @@ namespace MHWIBuildSearch
 {
 
 
+const SkillMap::Levels SkillMap::k_SECRET_LIMITS = [](){
+    Levels x {}; // Padding stays at zero.
+    for (const Skill* const skill : SkillsDatabase::g_all_skills) {
+        x[skill->nid] = skill->secret_limit;
+    }
+    return x;
+}();
+
+
 SkillMap::SkillMap(const ArmourPiece& armour_piece) noexcept
 {
     for (const auto& e : armour_piece.skills) {
@@ -23,6 +33,16 @@ SkillMap::SkillMap(const ArmourPiece& armour_piece) noexcept
 }
 
 
+void SkillMap::merge_in(const SkillMap& other) noexcept {
+    // Written as a plain loop over the whole array so the compiler can vectorize it.
+    // Levels never exceed their secret limits (at most 7), so the addition can't overflow.
+    for (std::size_t i = 0; i < k_CAPACITY; ++i) {
+        const Level v = this->levels[i] + other.levels[i];
+        this->levels[i] = std::min(v, k_SECRET_LIMITS[i]);
+    }
+}
+
+
 void SkillMap::merge_in(const std::vector<const Decoration*>& decos) noexcept {
     for (const Decoration* const deco : decos) {
         for (const auto& e : deco->skills) {
@@ -102,18 +122,43 @@ unsigned int SkillMap::get_non_secret(const Skill * const skill,
     // We expect secret skills to only have one level.
     assert(associated_secret->secret_limit == 1);
 
-    const auto skill_entry = this->find(skill);
-    if (skill_entry == this->end()) {
-        return 0;
+    const unsigned int level = this->get(skill);
+    const unsigned int normal_limit = skill->normal_limit;
+    if ((level <= normal_limit) || this->contains(associated_secret)) {
+        return level;
     } else {
-        const unsigned int level = skill_entry->second;
-        const unsigned int normal_limit = skill->normal_limit;
-        if (this->contains(associated_secret) || (level <= normal_limit)) {
-            return level;
-        } else {
-            return normal_limit;
-        }
+        return normal_limit;
+    }
+}
+
+
+unsigned int SkillMap::sum() const noexcept {
+    unsigned int ret = 0;
+    for (const Level v : this->levels) {
+        ret += v;
+    }
+    return ret;
+}
+
+
+std::size_t SkillMap::size() const noexcept {
+    std::size_t ret = 0;
+    for (const Level v : this->levels) {
+        ret += (v != 0);
+    }
+    return ret;
+}
+
+
+std::size_t SkillMap::calculate_hash() const noexcept {
+    static_assert(k_CAPACITY % sizeof(std::uint64_t) == 0);
+    std::uint64_t ret = 0;
+    for (std::size_t i = 0; i < k_CAPACITY; i += sizeof(std::uint64_t)) {
+        std::uint64_t w;
+        std::memcpy(&w, &this->levels[i], sizeof(w));
+        ret = (ret ^ w) * 0x100000001b3ull; // FNV-1a prime, applied a word at a time.
     }
+    return ret ^ (ret >> 29);
 }
 
 
@@ -0,0 +1,202 @@
+/*
+ * File: packed_skills.cpp
+ * Author: <contact@simshadows.com>
+ */
+
+#include <assert.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../support.h"
+#include "../../utils/utils.h"
+
+
+namespace MHWIBuildSearch
+{
+
+
+// Number of bits needed to represent x.
+static unsigned int bits_needed(unsigned int x) noexcept {
+    unsigned int ret = 0;
+    while (x) {
+        ++ret;
+        x >>= 1;
+    }
+    return ret;
+}
+
+
+SkillLayout::SkillLayout(const SkillSpec& skill_spec,
+                         const std::unordered_map<const SetBonus*, unsigned int>& set_bonus_subset)
+    : skill_fields  {}
+    , skill_present {}
+    , skills        {}
+    , setbonuses    {}
+    , limits        {}
+    , limits_p1     {}
+    , guards        {}
+    , value_masks   {}
+    , num_bits      {0}
+    , min_levels    {}
+{
+    for (const Skill * const skill : skill_spec.get_skill_subset_as_vector()) {
+        const Field f = this->add_field(skill->secret_limit);
+        this->skill_fields[skill->nid] = f;
+        this->skill_present[skill->nid] = true;
+        this->skills.emplace_back(skill, f);
+    }
+    for (const auto& e : set_bonus_subset) {
+        this->setbonuses.emplace_back(e.first, this->add_field(e.second));
+    }
+
+    for (const auto& e : skill_spec) {
+        if (e.second) this->min_levels.set(this->field(e.first), e.second);
+    }
+}
+
+
+bool SkillLayout::contains(const SetBonus * const set_bonus) const noexcept {
+    for (const auto& e : this->setbonuses) {
+        if (e.first == set_bonus) return true;
+    }
+    return false;
+}
+
+
+const PackedSkills::Field& SkillLayout::field(const SetBonus * const set_bonus) const {
+    for (const auto& e : this->setbonuses) {
+        if (e.first == set_bonus) return e.second;
+    }
+    throw std::logic_error("Set bonus is not in the layout.");
+}
+
+
+std::vector<PackedSkills::Field> SkillLayout::fields(const std::vector<const Skill*>& skill_vec) const {
+    std::vector<Field> ret;
+    for (const Skill * const skill : skill_vec) {
+        ret.emplace_back(this->field(skill));
+    }
+    return ret;
+}
+
+
+std::vector<PackedSkills::Field> SkillLayout::fields(const std::vector<const SetBonus*>& set_bonus_vec) const {
+    std::vector<Field> ret;
+    for (const SetBonus * const set_bonus : set_bonus_vec) {
+        ret.emplace_back(this->field(set_bonus));
+    }
+    return ret;
+}
+
+
+PackedSkills SkillLayout::pack(const SkillMap& skill_map) const noexcept {
+    PackedSkills ret;
+    for (const auto& e : this->skills) {
+        const unsigned int v = skill_map.get(e.first);
+        if (v) ret.set(e.second, v);
+    }
+    return ret;
+}
+
+
+PackedSkills SkillLayout::pack(const SkillMap& skill_map, const SetBonusMap& set_bonus_map) const noexcept {
+    PackedSkills ret = this->pack(skill_map);
+    for (const auto& e : this->setbonuses) {
+        const unsigned int v = set_bonus_map.get(e.first);
+        if (v) ret.set(e.second, v);
+    }
+    return ret;
+}
+
+
+PackedSkills SkillLayout::pack(const Decoration& deco) const noexcept {
+    PackedSkills ret;
+    for (const auto& e : deco.skills) {
+        if (this->contains(e.first)) ret.set(this->field(e.first), e.second);
+    }
+    return ret;
+}
+
+
+SkillMap SkillLayout::unpack_skills(const PackedSkills& x) const noexcept {
+    SkillMap ret;
+    for (const auto& e : this->skills) {
+        const unsigned int v = x.get(e.second);
+        if (v) ret.set(e.first, v);
+    }
+    return ret;
+}
+
+
+SetBonusMap SkillLayout::unpack_set_bonuses(const PackedSkills& x) const {
+    SetBonusMap ret;
+    for (const auto& e : this->setbonuses) {
+        const unsigned int v = x.get(e.second);
+        if (v) ret.set(e.first, v);
+    }
+    return ret;
+}
+
+
+PackedSkills SkillLayout::field_max(const PackedSkills& a, const PackedSkills& b) const noexcept {
+    PackedSkills ret;
+    for (const auto& e : this->skills) {
+        const unsigned int v = std::max(a.get(e.second), b.get(e.second));
+        if (v) ret.set(e.second, v);
+    }
+    for (const auto& e : this->setbonuses) {
+        const unsigned int v = std::max(a.get(e.second), b.get(e.second));
+        if (v) ret.set(e.second, v);
+    }
+    return ret;
+}
+
+
+unsigned int SkillLayout::sum(const PackedSkills& x) const noexcept {
+    unsigned int ret = 0;
+    for (const auto& e : this->skills) {
+        ret += x.get(e.second);
+    }
+    for (const auto& e : this->setbonuses) {
+        ret += x.get(e.second);
+    }
+    return ret;
+}
+
+
+PackedSkills::Field SkillLayout::add_field(const unsigned int limit) {
+    assert(limit);
+    // Value bits must hold the sum of two valid values. PackedSkills::merge_in() also relies on
+    // there being no more than 7 value bits, since its fill only reaches 7 bits below the guard bit.
+    const unsigned int value_bits = bits_needed(2 * limit);
+    if (value_bits > 7) {
+        throw std::logic_error("Packed skill field limit is too large.");
+    }
+    const unsigned int width = value_bits + 1; // Includes the guard bit.
+
+    // Fields never straddle words.
+    std::size_t word = this->num_bits / 64;
+    std::size_t shift = this->num_bits % 64;
+    if (shift + width > 64) {
+        ++word;
+        shift = 0;
+    }
+    if (word >= PackedSkills::k_NUM_WORDS) {
+        throw std::runtime_error("Too many skills and set bonuses to search over.");
+    }
+    this->num_bits = (word * 64) + shift + width;
+
+    this->limits[word]      |= Word(limit) << shift;
+    this->limits_p1[word]   |= Word(limit + 1) << shift;
+    this->guards[word]      |= Word(1) << (shift + value_bits);
+    this->value_masks[word] |= ((Word(1) << value_bits) - 1) << shift;
+
+    return {static_cast<std::uint8_t>(word),
+            static_cast<std::uint8_t>(shift),
+            static_cast<std::uint8_t>(value_bits),
+            static_cast<std::uint8_t>(limit) };
+}
+
+
+} // namespace
+
@@ -4,6 +4,7 @@
  */
 
 #include <assert.h>
+#include <cstring>
 #include <stdexcept>
 
 #include "../../database/database_skills.h"
@@ -13,6 +14,45 @@ namespace MHWIBuildSearch
 {
 
 
+// Every skill read by SharedSkillContribution's constructor.
+static const std::array<const Skill*, 30> contributing_skills = {
+    &SkillsDatabase::g_skill_affinity_sliding,
+    &SkillsDatabase::g_skill_agitator,
+    &SkillsDatabase::g_skill_agitator_secret,
+    &SkillsDatabase::g_skill_airborne,
+    &SkillsDatabase::g_skill_attack_boost,
+    &SkillsDatabase::g_skill_bludgeoner,
+    &SkillsDatabase::g_skill_coalescence,
+    &SkillsDatabase::g_skill_critical_boost,
+    &SkillsDatabase::g_skill_critical_draw,
+    &SkillsDatabase::g_skill_critical_eye,
+    &SkillsDatabase::g_skill_dragonvein_awakening,
+    &SkillsDatabase::g_skill_true_dragonvein_awakening,
+    &SkillsDatabase::g_skill_element_acceleration,
+    &SkillsDatabase::g_skill_true_element_acceleration,
+    &SkillsDatabase::g_skill_free_elem_ammo_up,
+    &SkillsDatabase::g_skill_fortify,
+    &SkillsDatabase::g_skill_frostcraft,
+    &SkillsDatabase::g_skill_handicraft,
+    &SkillsDatabase::g_skill_heroics,
+    &SkillsDatabase::g_skill_heroics_secret,
+    &SkillsDatabase::g_skill_latent_power,
+    &SkillsDatabase::g_skill_latent_power_secret,
+    &SkillsDatabase::g_skill_maximum_might,
+    &SkillsDatabase::g_skill_maximum_might_secret,
+    &SkillsDatabase::g_skill_non_elemental_boost,
+    &SkillsDatabase::g_skill_offensive_guard,
+    &SkillsDatabase::g_skill_peak_performance,
+    &SkillsDatabase::g_skill_punishing_draw,
+    &SkillsDatabase::g_skill_resentment,
+    &SkillsDatabase::g_skill_weakness_exploit,
+};
+static_assert(std::tuple_size<decltype(contributing_skills)>::value <= SharedSkillContributionCache::k_KEY_SIZE);
+
+// SharedSkillContributionCache starts evicting entries when it reaches this many.
+static constexpr std::size_t k_MAX_CACHED_CONTRIBUTIONS = 1 << 16;
+
+
 // Affinity Sliding
 static constexpr int k_AFFINITY_SLIDING_AFF = 30;
 
@@ -101,28 +141,26 @@ static constexpr std::array<int, 4> weakness_exploit_s1_aff = {0, 10, 15, 30};
 static constexpr std::array<int, 4> weakness_exploit_s2_aff = {0, 15, 30, 50};
 
 
-static SharpnessGauge calculate_final_sharpness_gauge(const SkillMap& skills,
+static SharpnessGauge calculate_final_sharpness_gauge(const unsigned int handicraft_lvl,
                                                       const WeaponContribution& wc) {
     if (wc.is_constant_sharpness) {
         return wc.maximum_sharpness;
     } else {
-        const unsigned int handicraft_lvl = skills.get(&SkillsDatabase::g_skill_handicraft);
         return wc.maximum_sharpness.apply_handicraft(handicraft_lvl);
     }
 }
 
 
-SkillContribution::SkillContribution(const SkillMap&           skills,
-                                     const SkillSpec&          skills_spec,
-                                     const WeaponClass         weapon_class,
-                                     const WeaponContribution& wc ) noexcept
+SharedSkillContribution::SharedSkillContribution(const SkillMap&   skills,
+                                                 const SkillSpec&  skills_spec,
+                                                 const WeaponClass weapon_class) noexcept
     : added_raw                 (0)
     , added_aff                 (0)
     , base_raw_multiplier       (1.0)
     , frostcraft_raw_multiplier (1.0)
-    , bludgeoner_added_raw      (0)
+    , bludgeoner_active         (false)
     , raw_crit_dmg_multiplier   (k_RAW_CRIT_DMG_MULTIPLIER_CB0)
-    , final_sharpness_gauge     (calculate_final_sharpness_gauge(skills, wc))
+    , handicraft_lvl            (skills.get(&SkillsDatabase::g_skill_handicraft))
     //, free_element_active_percentage (0) // We will initialize this later!
 {
     // We calculate the remaining fields.
@@ -177,22 +215,7 @@ SkillContribution::SkillContribution(const SkillMap&           skills,
 
             case SkillsDatabase::g_skillnid_bludgeoner: {
                     assert(lvl == 1);
-                    switch (this->final_sharpness_gauge.get_sharpness_level()) {
-                        case SharpnessLevel::red:
-                            this->bludgeoner_added_raw = k_BLUDGEONER_ADDED_RAW_RED;
-                            break;
-                        case SharpnessLevel::orange:
-                            this->bludgeoner_added_raw = k_BLUDGEONER_ADDED_RAW_ORANGE;
-                            break;
-                        case SharpnessLevel::yellow:
-                            this->bludgeoner_added_raw = k_BLUDGEONER_ADDED_RAW_YELLOW;
-                            break;
-                        case SharpnessLevel::green:
-                            this->bludgeoner_added_raw = k_BLUDGEONER_ADDED_RAW_GREEN;
-                            break;
-                        default:
-                            this->bludgeoner_added_raw = k_BLUDGEONER_ADDED_RAW_OTHER;
-                    }
+                    this->bludgeoner_active = true; // Depends on sharpness. (See SkillContribution.)
                 } break;
 
             case SkillsDatabase::g_skillnid_coalescence: {
@@ -371,13 +394,128 @@ SkillContribution::SkillContribution(const SkillMap&           skills,
         this->free_element_active_percentage = free_element_active_percentage_vals[effective_free_element_lvl];
     } else {
         this->free_element_active_percentage = 0;
-        // Since we know that Free Element is not active, we just need to test if the element is open.
-        if (wc.elestat_visibility != EleStatVisibility::open) {
-            this->base_raw_multiplier *= k_NON_ELEMENTAL_BOOST_MULTIPLIER;
-        }
     }
 }
 
 
+double SharedSkillContribution::get_base_raw_multiplier(const EleStatVisibility elestat_visibility) const noexcept {
+    // If Free Element is not active, we just need to test if the element is open.
+    if ((!this->free_element_active_percentage) && (elestat_visibility != EleStatVisibility::open)) {
+        return this->base_raw_multiplier * k_NON_ELEMENTAL_BOOST_MULTIPLIER;
+    }
+    return this->base_raw_multiplier;
+}
+
+
+unsigned int SkillContribution::calculate_bludgeoner_added_raw(const SharpnessLevel sharpness_level) noexcept {
+    switch (sharpness_level) {
+        case SharpnessLevel::red:    return k_BLUDGEONER_ADDED_RAW_RED;
+        case SharpnessLevel::orange: return k_BLUDGEONER_ADDED_RAW_ORANGE;
+        case SharpnessLevel::yellow: return k_BLUDGEONER_ADDED_RAW_YELLOW;
+        case SharpnessLevel::green:  return k_BLUDGEONER_ADDED_RAW_GREEN;
+        default:                     return k_BLUDGEONER_ADDED_RAW_OTHER;
+    }
+}
+
+
+SkillContribution::SkillContribution(const SharedSkillContribution& shared,
+                                     const WeaponContribution&      wc ) noexcept
+    : added_raw                      (shared.added_raw)
+    , added_aff                      (shared.added_aff)
+    , base_raw_multiplier            (shared.get_base_raw_multiplier(wc.elestat_visibility))
+    , frostcraft_raw_multiplier      (shared.frostcraft_raw_multiplier)
+    , bludgeoner_added_raw           (0)
+    , raw_crit_dmg_multiplier        (shared.raw_crit_dmg_multiplier)
+    , final_sharpness_gauge          (calculate_final_sharpness_gauge(shared.handicraft_lvl, wc))
+    , free_element_active_percentage (shared.free_element_active_percentage)
+{
+    if (shared.bludgeoner_active) {
+        this->bludgeoner_added_raw = calculate_bludgeoner_added_raw(this->final_sharpness_gauge.get_sharpness_level());
+    }
+}
+
+
+SkillContribution::SkillContribution(const SkillMap&           skills,
+                                     const SkillSpec&          skills_spec,
+                                     const WeaponClass         weapon_class,
+                                     const WeaponContribution& wc ) noexcept
+    : SkillContribution(SharedSkillContribution(skills, skills_spec, weapon_class), wc)
+{
+}
+
+
+
+std::size_t SharedSkillContributionCache::KeyHash::operator()(const Key& k) const noexcept {
+    static_assert(k_KEY_SIZE % sizeof(std::uint64_t) == 0);
+    std::uint64_t ret = 0;
+    for (std::size_t i = 0; i < k_KEY_SIZE; i += sizeof(std::uint64_t)) {
+        std::uint64_t w;
+        std::memcpy(&w, &k[i], sizeof(w));
+        ret = (ret ^ w) * 0x100000001b3ull; // Same as SkillMap::calculate_hash().
+    }
+    return ret ^ (ret >> 29);
+}
+
+
+SharedSkillContributionCache::SharedSkillContributionCache(const SkillSpec&  new_skill_spec,
+                                                           const WeaponClass new_weapon_class) noexcept
+    : skill_spec   (new_skill_spec)
+    , weapon_class (new_weapon_class)
+    , slots        {}
+    , slot_indices {}
+    , clock_hand   {0}
+    , stat_hits    {0}
+    , stat_misses  {0}
+{
+}
+
+
+const SharedSkillContribution& SharedSkillContributionCache::get(const SkillMap& skills) {
+    Key k {};
+    for (std::size_t i = 0; i < contributing_skills.size(); ++i) {
+        k[i] = skills.get(contributing_skills[i]);
+    }
+
+    const auto result = this->slot_indices.find(k);
+    if (result != this->slot_indices.end()) {
+        ++this->stat_hits;
+        Slot& slot = this->slots[result->second];
+        slot.referenced = true;
+        return slot.value;
+    }
+    ++this->stat_misses;
+
+    SharedSkillContribution value (skills, this->skill_spec, this->weapon_class);
+    if (this->slots.size() < k_MAX_CACHED_CONTRIBUTIONS) {
+        this->slot_indices.emplace(k, this->slots.size());
+        this->slots.push_back({k, value, false});
+        return this->slots.back().value;
+    }
+
+    // Advance the clock hand past recently referenced slots, clearing their referenced bits as we go.
+    while (this->slots[this->clock_hand].referenced) {
+        this->slots[this->clock_hand].referenced = false;
+        this->clock_hand = (this->clock_hand + 1) % this->slots.size();
+    }
+    const std::size_t victim = this->clock_hand;
+    this->clock_hand = (this->clock_hand + 1) % this->slots.size();
+
+    Slot& slot = this->slots[victim];
+    this->slot_indices.erase(slot.key);
+    this->slot_indices.emplace(k, victim);
+    slot = {k, value, false};
+    return slot.value;
+}
+
+
+std::size_t SharedSkillContributionCache::get_stat_hits() const noexcept {
+    return this->stat_hits;
+}
+
+
+std::size_t SharedSkillContributionCache::get_stat_misses() const noexcept {
+    return this->stat_misses;
+}
+
 } // namespace
 
@@ -6,10 +6,16 @@
 #ifndef MHWIBS_SUPPORT_H
 #define MHWIBS_SUPPORT_H
 
+#include <assert.h>
+#include <array>
+#include <cstdint>
+#include <iterator>
 #include <unordered_map>
+#include <vector>
 
 #include "../core/core.h"
 #include "../database/database.h"
+#include "../database/database_skills.h"
 #include "../utils/counter.h"
 
 namespace MHWIBuildSearch
@@ -88,24 +94,128 @@ using SetBonusMap = Utils::CounterPKSV<const SetBonus*, HardClipSetBonusPieces>;
  ***************************************************************************************/
 
 
-struct HardClipSkillLevel {
-    unsigned int operator()(const Skill * const skill, const unsigned int lvl) const noexcept {
-        return (lvl > skill->secret_limit) ? skill->secret_limit : lvl;
-    }
-};
+// Note that this container automatically clips levels to secret_limit.
+//
+// Levels are stored in a fixed-size array indexed by Skill::nid. The search copies, merges, compares and
+// hashes skill maps far more often than it does anything else with them, and a flat array makes all of
+// those straight loops over a few cache lines with no allocations.
+//
+// The interface mirrors Utils::Counter. Iterating only visits skills with non-zero levels, in nid order.
+class SkillMap {
+    using N = unsigned int;
+    using Level = std::uint8_t;
 
+    // Rounded up to whole 64-bit words so hashing can work a word at a time.
+    static constexpr std::size_t k_CAPACITY = ((SkillsDatabase::g_num_skills + 7) / 8) * 8;
 
-// Note that this container automatically clips levels to secret_limit.
-class SkillMap : public Utils::CounterPKSV<const Skill*, HardClipSkillLevel> {
+    using Levels = std::array<Level, k_CAPACITY>;
+
+    static const Levels k_SECRET_LIMITS;
+
+    Levels levels {};
 public:
-    using Utils::CounterPKSV<const Skill*, HardClipSkillLevel>::CounterPKSV;
 
+    using key_type = const Skill*;
+
+    class ConstIterator {
+        const Levels* levels;
+        std::size_t   i;
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = std::pair<const Skill*, N>;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = void;
+        using reference         = value_type;
+
+        ConstIterator(const Levels* new_levels, const std::size_t new_i) noexcept
+            : levels {new_levels}
+            , i      {new_i}
+        {
+            this->skip_zeroes();
+        }
+
+        value_type operator*() const noexcept {
+            assert(i < SkillsDatabase::g_num_skills);
+            return {SkillsDatabase::g_all_skills[i], (*levels)[i]};
+        }
+
+        ConstIterator& operator++() noexcept {
+            ++i;
+            this->skip_zeroes();
+            return *this;
+        }
+
+        bool operator==(const ConstIterator& x) const noexcept {
+            return i == x.i;
+        }
+
+        bool operator!=(const ConstIterator& x) const noexcept {
+            return i != x.i;
+        }
+
+    private:
+        void skip_zeroes() noexcept {
+            while ((i < SkillsDatabase::g_num_skills) && ((*levels)[i] == 0)) ++i;
+        }
+    };
+
+    SkillMap() noexcept = default;
     SkillMap(const ArmourPiece&) noexcept;
 
-    using Utils::CounterPKSV<const Skill*, HardClipSkillLevel>::merge_in;
+    /*
+     * Modifiers
+     */
+
+    // Use this if you only ever intend to allow v>0.
+    void set(const Skill* const k, const N v) noexcept {
+        assert(v != 0);
+        this->levels[k->nid] = clip(k, v);
+    }
+
+    // This version will allow v=0.
+    void set_or_remove(const Skill* const k, const N v) noexcept {
+        this->levels[k->nid] = clip(k, v);
+    }
+
+    // Use this if you only intend to remove existing elements.
+    void remove(const Skill* const k) noexcept {
+        assert(this->get(k));
+        this->levels[k->nid] = 0;
+    }
+
+    // If the element doesn't exist, this won't fail.
+    void try_remove(const Skill* const k) noexcept {
+        this->levels[k->nid] = 0;
+    }
+
+    // Do not use this with v_to_add=0.
+    void increment(const Skill* const k, const N v_to_add) noexcept {
+        assert(v_to_add != 0);
+        this->levels[k->nid] = clip(k, this->levels[k->nid] + v_to_add);
+    }
+
+    // Do not use this with v_to_subtract=0.
+    // Do not use this with keys that aren't in the counter.
+    void decrement(const Skill* const k, const N v_to_subtract) noexcept {
+        assert(v_to_subtract != 0);
+        assert(this->contains(k));
+        const N v = this->levels[k->nid];
+        this->levels[k->nid] = (v_to_subtract < v) ? (v - v_to_subtract) : 0;
+    }
+
+    void merge_in(const SkillMap&) noexcept;
     void merge_in(const std::vector<const Decoration*>&) noexcept; // Special case
     void merge_in(const DecoEquips&); // Special case
 
+    // Merge in a linear representation of a counter, such as a vector of key-value pairs.
+    // IMPORTANT: Do not have zeroes on the right side!
+    template<class P>
+    void merge_in(const P& obj) noexcept {
+        for (const std::pair<const Skill*, N>& e : obj) {
+            this->increment(e.first, e.second);
+        }
+    }
+
     void add_set_bonuses(const SetBonusMap&);
 
     // Only adds skills from the skill spec
@@ -115,6 +225,40 @@ public:
     void add_skills_filtered(const Decoration&, const SkillSpec&);
     void add_skills_filtered(const std::vector<const Decoration*>&, const SkillSpec&);
 
+    /*
+     * Accessors
+     */
+
+    // Gets a skill's level. Skills that aren't in the container return zero.
+    N get(const Skill* const k) const noexcept {
+        return this->levels[k->nid];
+    }
+
+    bool contains(const Skill* const k) const noexcept {
+        return this->levels[k->nid] != 0;
+    }
+
+    N sum() const noexcept;
+    std::size_t size() const noexcept;
+
+    ConstIterator begin() const noexcept {
+        return ConstIterator(&this->levels, 0);
+    }
+
+    ConstIterator end() const noexcept {
+        return ConstIterator(&this->levels, SkillsDatabase::g_num_skills);
+    }
+
+    bool operator==(const SkillMap& x) const noexcept {
+        return this->levels == x.levels;
+    }
+
+    bool operator!=(const SkillMap& x) const noexcept {
+        return this->levels != x.levels;
+    }
+
+    std::size_t calculate_hash() const noexcept;
+
     // Gets a skill's level. Skills that aren't in the container return zero.
     unsigned int get_non_secret(const Skill* skill, const Skill* associated_secret) const;
     bool is_at_least_lvl1(const Skill* skill) const;
@@ -123,9 +267,217 @@ public:
     std::string get_humanreadable() const;
 
     bool only_contains_skills_in_spec(const SkillSpec&) const noexcept;
+
+private:
+    static Level clip(const Skill* const k, const N v) noexcept {
+        assert(k->nid < SkillsDatabase::g_num_skills);
+        return (v > k->secret_limit) ? k->secret_limit : v;
+    }
+};
+
+
+/****************************************************************************************
+ * PackedSkills and SkillLayout
+ ***************************************************************************************/
+
+
+class SkillLayout;
+
+
+// Skill levels and set bonus piece counts packed into small bit fields within a few 64-bit words.
+//
+// Field positions are decided by a SkillLayout, which only covers what a single search cares about.
+// Merging (with each field clipped to its limit) and dominance tests work on whole words at a time,
+// so they cost the same regardless of how many skills are set.
+//
+// Each field is laid out (from the least significant bit) as:
+//      - enough value bits to hold twice the field's limit (i.e. the sum of two valid values), and
+//      - one guard bit, which is always zero outside of intermediate calculations.
+class PackedSkills {
+public:
+    static constexpr std::size_t k_NUM_WORDS = 4;
+
+    using Word  = std::uint64_t;
+    using Words = std::array<Word, k_NUM_WORDS>;
+
+    struct Field {
+        std::uint8_t word;
+        std::uint8_t shift;
+        std::uint8_t value_bits;
+        std::uint8_t limit;
+    };
+
+    using key_type = Field;
+
+private:
+    Words words {};
+
+public:
+
+    /*
+     * Counter-like interface, as used by the seen maps.
+     */
+
+    unsigned int get(const Field& f) const noexcept {
+        return (this->words[f.word] >> f.shift) & ((Word(1) << f.value_bits) - 1);
+    }
+
+    bool contains(const Field& f) const noexcept {
+        return this->get(f) != 0;
+    }
+
+    // Values are clipped to the field's limit.
+    void set_or_remove(const Field& f, const unsigned int v) noexcept {
+        const Word mask = ((Word(1) << f.value_bits) - 1) << f.shift;
+        const Word clipped = (v > f.limit) ? f.limit : v;
+        this->words[f.word] = (this->words[f.word] & ~mask) | (clipped << f.shift);
+    }
+
+    void set(const Field& f, const unsigned int v) noexcept {
+        assert(v != 0);
+        this->set_or_remove(f, v);
+    }
+
+    void remove(const Field& f) noexcept {
+        assert(this->get(f));
+        this->set_or_remove(f, 0);
+    }
+
+    bool operator==(const PackedSkills& x) const noexcept {
+        return this->words == x.words;
+    }
+
+    bool operator!=(const PackedSkills& x) const noexcept {
+        return this->words != x.words;
+    }
+
+    std::size_t calculate_hash() const noexcept {
+        std::uint64_t ret = 0;
+        for (const Word w : this->words) {
+            ret = (ret ^ w) * 0x100000001b3ull;
+        }
+        return ret ^ (ret >> 29);
+    }
+
+    /*
+     * Whole-word operations. (These require the layout that the fields were packed with.)
+     */
+
+    // Adds every field of other into this, clipping each field to its limit.
+    inline void merge_in(const PackedSkills& other, const SkillLayout& layout) noexcept;
+
+    // Returns true if every field of this is greater than or equal to the same field of other.
+    inline bool dominates(const PackedSkills& other, const SkillLayout& layout) const noexcept;
 };
 
 
+// Assigns a field in PackedSkills to each skill in a skill spec, and to each set bonus being considered.
+class SkillLayout {
+    using Field = PackedSkills::Field;
+    using Word  = PackedSkills::Word;
+    using Words = PackedSkills::Words;
+
+    // Indexed by Skill::nid. Only the skills in the layout have entries in skill_present.
+    std::array<Field, SkillsDatabase::g_num_skills> skill_fields;
+    std::array<bool, SkillsDatabase::g_num_skills>  skill_present;
+
+    std::vector<std::pair<const Skill*, Field>>    skills;
+    std::vector<std::pair<const SetBonus*, Field>> setbonuses;
+
+    Words limits;       // Each field holds its limit.
+    Words limits_p1;    // Each field holds its limit plus one.
+    Words guards;       // Each field has only its guard bit set.
+    Words value_masks;  // Each field has all of its value bits set.
+
+    std::size_t num_bits;
+
+    PackedSkills min_levels;
+public:
+    // set_bonus_subset maps each set bonus to the highest number of pieces worth counting.
+    // Throws std::runtime_error if the fields don't fit.
+    SkillLayout(const SkillSpec&, const std::unordered_map<const SetBonus*, unsigned int>& set_bonus_subset);
+
+    bool contains(const Skill* const skill) const noexcept {
+        return this->skill_present[skill->nid];
+    }
+
+    const Field& field(const Skill* const skill) const noexcept {
+        assert(this->contains(skill));
+        return this->skill_fields[skill->nid];
+    }
+
+    bool contains(const SetBonus*) const noexcept;
+
+    const Field& field(const SetBonus*) const;
+
+    std::vector<Field> fields(const std::vector<const Skill*>&) const;
+    std::vector<Field> fields(const std::vector<const SetBonus*>&) const;
+
+    // Skills and set bonuses outside of the layout are ignored.
+    PackedSkills pack(const SkillMap&) const noexcept;
+    PackedSkills pack(const SkillMap&, const SetBonusMap&) const noexcept;
+    PackedSkills pack(const Decoration&) const noexcept;
+
+    SkillMap unpack_skills(const PackedSkills&) const noexcept;
+    SetBonusMap unpack_set_bonuses(const PackedSkills&) const;
+
+    // Each field of the result is the larger of the same field in a and b.
+    PackedSkills field_max(const PackedSkills& a, const PackedSkills& b) const noexcept;
+
+    // Sum of all skill levels and set bonus pieces.
+    unsigned int sum(const PackedSkills&) const noexcept;
+
+    // Equivalent to SkillSpec::skills_meet_minimum_requirements() for the spec this layout was made from.
+    bool meets_minimum_requirements(const PackedSkills& x) const noexcept {
+        return x.dominates(this->min_levels, *this);
+    }
+
+    std::size_t get_num_bits() const noexcept {
+        return this->num_bits;
+    }
+
+private:
+    friend class PackedSkills;
+
+    Field add_field(const unsigned int limit);
+};
+
+
+inline void PackedSkills::merge_in(const PackedSkills& other, const SkillLayout& layout) noexcept {
+    for (std::size_t i = 0; i < k_NUM_WORDS; ++i) {
+        // Sums fit within the value bits, so nothing carries into other fields.
+        const Word sum = this->words[i] + other.words[i];
+
+        // The guard bit of a field survives the subtraction if and only if the sum exceeds the limit.
+        const Word over = ((sum | layout.guards[i]) - layout.limits_p1[i]) & layout.guards[i];
+
+        // Fill each surviving guard bit down through the value bits of its own field. Three steps reach
+        // 7 bits below the guard bit, which is the most value bits a field can have. (See add_field().)
+        // (The guard bits of lower fields stop the fill from spilling over.)
+        Word fill = over;
+        Word prop = layout.value_masks[i];
+        fill |= prop & (fill >> 1);
+        prop &= prop >> 1;
+        fill |= prop & (fill >> 2);
+        prop &= prop >> 2;
+        fill |= prop & (fill >> 4);
+        fill &= layout.value_masks[i];
+
+        this->words[i] = (sum & ~fill) | (layout.limits[i] & fill);
+    }
+}
+
+
+inline bool PackedSkills::dominates(const PackedSkills& other, const SkillLayout& layout) const noexcept {
+    Word ok = ~Word(0);
+    for (std::size_t i = 0; i < k_NUM_WORDS; ++i) {
+        // The guard bit of a field survives the subtraction if and only if there is no borrow.
+        ok &= ((this->words[i] | layout.guards[i]) - other.words[i]) | ~layout.guards[i];
+    }
+    return ok == ~Word(0);
+}
+
+
 /****************************************************************************************
  * ArmourEquips
  ***************************************************************************************/
@@ -151,6 +503,8 @@ public:
 
     bool slot_is_filled(const ArmourSlot&) const;
     bool charm_slot_is_filled() const;
+    const ArmourPiece* get_piece(const ArmourSlot&) const; // nullptr if the slot isn't filled.
+    const Charm* get_charm() const;                         // nullptr if the charm slot isn't filled.
     SkillMap get_skills_without_set_bonuses() const;
     SkillMap get_skills_without_set_bonuses_filtered(const SkillSpec&) const;
     SetBonusMap get_set_bonuses() const;
@@ -272,6 +626,25 @@ public:
  ***************************************************************************************/
 
 
+// The parts of SkillContribution that don't depend on the individual weapon (other than its class).
+// Computing this once allows many weapons with the same skills to be evaluated cheaply.
+struct SharedSkillContribution {
+    unsigned int   added_raw;
+    int            added_aff;
+    double         base_raw_multiplier; // Excludes Non-elemental Boost. (Use get_base_raw_multiplier().)
+    double         frostcraft_raw_multiplier;
+    bool           bludgeoner_active;
+    double         raw_crit_dmg_multiplier;
+    unsigned int   handicraft_lvl;
+
+    unsigned int   free_element_active_percentage; // Zero if Free Element is not active.
+
+    SharedSkillContribution(const SkillMap&, const SkillSpec&, WeaponClass) noexcept;
+
+    double get_base_raw_multiplier(EleStatVisibility) const noexcept;
+};
+
+
 struct SkillContribution {
     unsigned int   added_raw;
     int            added_aff;
@@ -283,10 +656,58 @@ struct SkillContribution {
 
     unsigned int   free_element_active_percentage;
 
+    SkillContribution(const SharedSkillContribution&, const WeaponContribution&) noexcept;
     SkillContribution(const SkillMap&,
                       const SkillSpec&,
                       WeaponClass,
                       const WeaponContribution&) noexcept;
+
+    static unsigned int calculate_bludgeoner_added_raw(SharpnessLevel) noexcept;
+};
+
+
+// Memoizes SharedSkillContribution for a fixed SkillSpec and weapon class.
+//
+// Entries are keyed only on the levels of skills that SharedSkillContribution actually reads, so skill
+// maps that differ only in other skills (such as defensive skills) share the same entry.
+//
+// Once full, entries are evicted one at a time with the clock (second chance) policy, so entries that
+// keep getting hit survive while stale ones are replaced.
+//
+// Not thread-safe. Each thread should have its own cache.
+class SharedSkillContributionCache {
+public:
+    static constexpr std::size_t k_KEY_SIZE = 32;
+    using Key = std::array<std::uint8_t, k_KEY_SIZE>;
+private:
+    struct KeyHash {
+        std::size_t operator()(const Key&) const noexcept;
+    };
+
+    struct Slot {
+        Key                     key;
+        SharedSkillContribution value;
+        bool                    referenced;
+    };
+
+    const SkillSpec& skill_spec;
+    WeaponClass      weapon_class;
+
+    std::vector<Slot>                                 slots;
+    std::unordered_map<Key, std::size_t, KeyHash>     slot_indices;
+    std::size_t                                       clock_hand;
+
+    std::size_t stat_hits;
+    std::size_t stat_misses;
+public:
+    SharedSkillContributionCache(const SkillSpec&, WeaponClass) noexcept;
+
+    // Same as SharedSkillContribution(skills, skill_spec, weapon_class).
+    // The reference is only valid until the next call.
+    const SharedSkillContribution& get(const SkillMap& skills);
+
+    std::size_t get_stat_hits() const noexcept;
+    std::size_t get_stat_misses() const noexcept;
 };
 
 
@@ -376,6 +797,52 @@ ModelCalculatedValues calculate_damage(const DamageModel&,
                                        const EffectiveDamageValues&);
 
 
+/****************************************************************************************
+ * WeaponBatch
+ ***************************************************************************************/
+
+
+// Weapons of the same weapon class, stored as structure-of-arrays so that they can all be evaluated
+// against the same skills in one pass.
+//
+// The skill-dependent parts of the calculation are only done once per pass, and everything that depends
+// on handicraft is precomputed for each handicraft level.
+class WeaponBatch {
+    WeaponClass weapon_class;
+
+    std::vector<unsigned int>      weapon_raw;
+    std::vector<int>               weapon_aff;
+    std::vector<EleStatVisibility> elestat_visibility;
+    std::vector<EleStatType>       elestat_type;
+    std::vector<double>            elestat_value;
+
+    // Indexed by handicraft level, then by weapon.
+    std::vector<std::vector<double>>       raw_sharpness_modifier;
+    std::vector<std::vector<double>>       elemental_sharpness_modifier;
+    std::vector<std::vector<unsigned int>> bludgeoner_added_raw;
+public:
+    explicit WeaponBatch(WeaponClass) noexcept;
+
+    void push_back(const WeaponContribution&);
+
+    std::size_t size() const noexcept;
+
+    // Writes the unrounded total damage of each weapon into out, in the order the weapons were added.
+    // Results are the same as calculate_edv_from_skills_lookup() followed by calculate_damage().
+    void calculate_total_damage(const SkillMap&,
+                                const MiscBuffsEquips&,
+                                const SkillSpec&,
+                                const DamageModel&,
+                                std::vector<double>& out) const;
+
+    // Same as above, but with the skills' contribution already calculated for this batch's weapon class.
+    void calculate_total_damage(const SharedSkillContribution&,
+                                const MiscBuffsEquips&,
+                                const DamageModel&,
+                                std::vector<double>& out) const;
+};
+
+
 } // namespace
 
 #endif // MHWIBS_SUPPORT_H
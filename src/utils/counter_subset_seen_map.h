@@ -6,7 +6,17 @@
 #ifndef COUNTER_SUBSET_SEEN_MAP_H
 #define COUNTER_SUBSET_SEEN_MAP_H
 
+#include <assert.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
 #include <tuple>
+#include <unordered_map>
+#include <vector>
 
 
 namespace Utils
@@ -158,6 +168,199 @@ constexpr std::size_t k_SEEN_TREE_SEEN_FLAG_INDEX = 0;
 constexpr std::size_t k_SEEN_TREE_CLEARED_FLAG_INDEX = 1;
 
 
+// Seen tree storage for BasicBitTreeCounterSubsetSeenMap.
+//
+// Both storage classes act as a fixed-size array of bits that all start false, and are only ever set.
+
+
+// Stores every bit of the tree.
+//
+// This is the fastest, but the tree's size is the product of (limit + 1) over every key, so this can get
+// extremely large for wide key subsets even though most of it is never touched.
+class DenseSeenTree {
+    std::vector<bool> bits;
+public:
+    explicit DenseSeenTree(const std::size_t new_size) noexcept
+        : bits (new_size, false)
+    {
+    }
+
+    std::size_t size() const noexcept {
+        return this->bits.size();
+    }
+
+    bool test(const std::size_t i) const noexcept {
+        return this->bits[i];
+    }
+
+    void set(const std::size_t i) noexcept {
+        this->bits[i] = true;
+    }
+
+    bool uses_dense_storage() const noexcept {
+        return true;
+    }
+};
+
+
+// Splits the tree into fixed-size pages, which are only allocated when a bit in them is first set.
+// Untouched pages read as all false.
+//
+// Memory use is proportional to the number of touched pages rather than the size of the tree, and since
+// the tree is traversed with a lot of locality, touched pages tend to be dense and stay cache-resident.
+//
+// Pages are found through a flat page table if it's small enough (4 bytes per page, which is a small
+// fraction of the size of a dense tree). Otherwise, pages are found through a hash map, with a small
+// direct-mapped cache of recently used pages in front of it.
+//
+// test() only reads the tree (so it can be called from many threads at once) if the page table is flat.
+class PagedSeenTree {
+    using Word = std::uint64_t;
+
+    static constexpr std::size_t k_WORD_BITS        = 64;
+public:
+    static constexpr std::size_t k_PAGE_WORDS       = 64; // 4096 bits per page.
+    static constexpr std::size_t k_PAGE_BITS        = k_PAGE_WORDS * k_WORD_BITS;
+    static constexpr std::size_t k_MAX_FLAT_PAGES   = std::size_t(1) << 24; // 64 MiB page table.
+private:
+    static constexpr std::size_t k_PAGE_CACHE_SIZE  = 64;
+
+    static constexpr std::uint32_t k_NO_PAGE = std::numeric_limits<std::uint32_t>::max();
+
+    using Page = std::array<Word, k_PAGE_WORDS>;
+
+    struct CacheEntry {
+        std::size_t   page_number;
+        std::uint32_t page_index; // k_NO_PAGE if the page was untouched when cached.
+    };
+
+    std::size_t tree_size;
+
+    std::vector<Page> pages;
+
+    // Exactly one of these is used to map page numbers to indices of pages.
+    std::vector<std::uint32_t>                      flat_page_table; // k_NO_PAGE if untouched.
+    std::unordered_map<std::size_t, std::uint32_t> page_indices;
+
+    mutable std::array<CacheEntry, k_PAGE_CACHE_SIZE> cache; // Only used with page_indices.
+public:
+    explicit PagedSeenTree(const std::size_t new_size) noexcept
+        : tree_size       (new_size)
+        , pages           {}
+        , flat_page_table {}
+        , page_indices    {}
+        , cache           {}
+    {
+        const std::size_t num_pages = (new_size + k_PAGE_BITS - 1) / k_PAGE_BITS;
+        if (num_pages <= k_MAX_FLAT_PAGES) this->flat_page_table.assign(num_pages, k_NO_PAGE);
+
+        for (std::size_t i = 0; i < k_PAGE_CACHE_SIZE; ++i) {
+            // An entry for page i can only ever be found at position i, so any page number that maps
+            // elsewhere marks an entry as unused.
+            this->cache[i] = {i + 1, k_NO_PAGE};
+        }
+    }
+
+    std::size_t size() const noexcept {
+        return this->tree_size;
+    }
+
+    bool test(const std::size_t i) const noexcept {
+        assert(i < this->tree_size);
+        const std::uint32_t page_index = this->find_page(i / k_PAGE_BITS);
+        if (page_index == k_NO_PAGE) return false;
+        const std::size_t j = i % k_PAGE_BITS;
+        return (this->pages[page_index][j / k_WORD_BITS] >> (j % k_WORD_BITS)) & 1;
+    }
+
+    void set(const std::size_t i) noexcept {
+        assert(i < this->tree_size);
+        const std::size_t page_number = i / k_PAGE_BITS;
+        std::uint32_t page_index = this->find_page(page_number);
+        if (page_index == k_NO_PAGE) {
+            assert(this->pages.size() < k_NO_PAGE);
+            page_index = this->pages.size();
+            this->pages.emplace_back(); // Value-initialized, so all bits are false.
+            if (this->flat_page_table.size()) {
+                this->flat_page_table[page_number] = page_index;
+            } else {
+                this->page_indices.emplace(page_number, page_index);
+                this->cache[page_number % k_PAGE_CACHE_SIZE] = {page_number, page_index};
+            }
+        }
+        const std::size_t j = i % k_PAGE_BITS;
+        this->pages[page_index][j / k_WORD_BITS] |= Word(1) << (j % k_WORD_BITS);
+    }
+
+    bool uses_dense_storage() const noexcept {
+        return false;
+    }
+
+    // Number of bytes used by allocated pages and the page table.
+    std::size_t allocated_bytes() const noexcept {
+        return (this->pages.size() * sizeof(Page))
+               + (this->flat_page_table.size() * sizeof(std::uint32_t))
+               + (this->page_indices.size() * (sizeof(std::size_t) + sizeof(std::uint32_t)));
+    }
+
+private:
+    std::uint32_t find_page(const std::size_t page_number) const noexcept {
+        if (this->flat_page_table.size()) return this->flat_page_table[page_number];
+        CacheEntry& entry = this->cache[page_number % k_PAGE_CACHE_SIZE];
+        if (entry.page_number != page_number) {
+            const auto result = this->page_indices.find(page_number);
+            entry = {page_number, (result == this->page_indices.end()) ? k_NO_PAGE : result->second};
+        }
+        return entry.page_index;
+    }
+};
+
+
+// Uses a DenseSeenTree if the tree is no larger than k_MAX_DENSE_SIZE bits, and a PagedSeenTree otherwise.
+//
+// A dense tree is faster when it's small enough to be cheap to allocate, since small trees tend to be
+// mostly touched anyway.
+class AdaptiveSeenTree {
+public:
+    static constexpr std::size_t k_MAX_DENSE_SIZE = std::size_t(1) << 33; // 1 GiB.
+private:
+    bool          is_dense;
+    DenseSeenTree dense;
+    PagedSeenTree paged;
+public:
+    explicit AdaptiveSeenTree(const std::size_t new_size) noexcept
+        : is_dense (new_size <= k_MAX_DENSE_SIZE)
+        , dense    (this->is_dense ? new_size : 0)
+        , paged    (this->is_dense ? 0 : new_size)
+    {
+    }
+
+    std::size_t size() const noexcept {
+        return this->is_dense ? this->dense.size() : this->paged.size();
+    }
+
+    bool test(const std::size_t i) const noexcept {
+        return this->is_dense ? this->dense.test(i) : this->paged.test(i);
+    }
+
+    void set(const std::size_t i) noexcept {
+        if (this->is_dense) {
+            this->dense.set(i);
+        } else {
+            this->paged.set(i);
+        }
+    }
+
+    bool uses_dense_storage() const noexcept {
+        return this->is_dense;
+    }
+};
+
+
+template<class D, class ValueHardLimitFn, class SeenTree, class... Cv>
+class ConcurrentBitTreeCounterSubsetSeenMap;
+
+
 // Bit Tree Counter-Subset-Seen Map
 //
 // Advantages:
@@ -171,8 +374,11 @@ constexpr std::size_t k_SEEN_TREE_CLEARED_FLAG_INDEX = 1;
 // Due to its simplicity, this version is suitable for simple use cases.
 // (This version is also a suitable model for testing more efficient implementations.)
 //
-template<class D, class ValueHardLimitFn, class... Cv>
-class BitTreeCounterSubsetSeenMap {
+// SeenTree is the seen tree storage (see DenseSeenTree, PagedSeenTree, and AdaptiveSeenTree).
+// BitTreeCounterSubsetSeenMap uses DenseSeenTree.
+//
+template<class D, class ValueHardLimitFn, class SeenTree, class... Cv>
+class BasicBitTreeCounterSubsetSeenMap {
     using T = std::tuple<Cv...>;
     using T_size = std::tuple_size<T>;
 
@@ -186,19 +392,26 @@ class BitTreeCounterSubsetSeenMap {
 
     using H = Utils::CounterTupleHash<Cv...>;
 
+    template<class, class, class, class...>
+    friend class ConcurrentBitTreeCounterSubsetSeenMap;
+
     // When we traverse the tree, each level corresponds to keys in this order.
     O key_order;
 
-    // See build_tree() for the size of this vector.
+    // See build_tree() for the size of this tree.
     // See k_SEEN_TREE_ELEMENT_SIZE and the other constants for tree access.
-    std::vector<bool> seen_tree;
+    SeenTree seen_tree;
 
     std::unordered_map<T, D, H> data;
 
 public:
 
+    // Holds entries that were moved out of a map. (See take_generation().)
+    using Generation = std::vector<typename std::unordered_map<T, D, H>::node_type>;
+
+    // Throws std::runtime_error if the seen tree would be too large to index. (See build_tree().)
     template<class... Args>
-    BitTreeCounterSubsetSeenMap(Args&&... args) noexcept
+    BasicBitTreeCounterSubsetSeenMap(Args&&... args)
         : key_order    {std::make_tuple(std::forward<Args>(args)...)}
         , seen_tree    {build_tree(key_order)}
         , data         {}
@@ -232,6 +445,23 @@ public:
         }
     }
 
+    // Moves all data from other into this map, as if add() was called for each element of other.
+    // other is left empty.
+    void merge_in(BasicBitTreeCounterSubsetSeenMap&& other) noexcept {
+        while (other.data.size()) {
+            auto node = other.data.extract(other.data.begin());
+            this->add(std::move(node.mapped()), std::move(node.key()));
+        }
+    }
+
+    // Constructs a new empty map with the same key subset and limits.
+    BasicBitTreeCounterSubsetSeenMap clone_empty() const noexcept {
+        const auto op = [](const auto&... xv){
+            return BasicBitTreeCounterSubsetSeenMap(xv...);
+        };
+        return std::apply(op, this->key_order);
+    }
+
     std::vector<std::pair<T, D>> get_data_as_vector() const noexcept {
         std::vector<std::pair<T, D>> ret;
         for (const std::pair<T, D>& e : this->data) {
@@ -240,6 +470,65 @@ public:
         return ret;
     }
 
+    // Moves all data out of the map, leaving it empty. The seen tree is kept, so anything added later
+    // is still rejected if it's a subset of anything taken.
+    std::vector<std::pair<T, D>> take_data() {
+        std::vector<std::pair<T, D>> ret;
+        ret.reserve(this->data.size());
+        while (this->data.size()) {
+            auto node = this->data.extract(this->data.begin());
+            ret.emplace_back(std::move(node.key()), std::move(node.mapped()));
+        }
+        return ret;
+    }
+
+    // Generation-based iteration, for adding to the map while reading its existing entries (e.g. to add
+    // an extension of every existing key) without copying them.
+    //
+    // take_generation() moves all entries out of the map, without copying or reallocating them. Entries can
+    // then be added while reading the previous generation, and restore_generation() puts back every entry
+    // of the previous generation that hasn't since been replaced by a superset. This gives the same result
+    // as adding while reading a copy of the entries.
+    Generation take_generation() {
+        Generation ret;
+        ret.reserve(this->data.size());
+        while (this->data.size()) {
+            ret.emplace_back(this->data.extract(this->data.begin()));
+        }
+        return ret;
+    }
+
+    // Marks the keys of a generation taken from another map (with the same key subset and limits) as seen, as
+    // if add() was called for each of them.
+    //
+    // Entries that add() would have kept are moved to the front of g, in their original order, and their number
+    // is returned. Only these entries may be passed to this map's restore_generation(), which then moves them in
+    // without copying them.
+    std::size_t mark_generation(Generation& g) noexcept {
+        std::size_t ret = 0;
+        for (std::size_t i = 0; i < g.size(); ++i) {
+            T w;
+            const bool success = this->add_power_set_inode<0>(0,
+                                                              this->seen_tree.size(),
+                                                              g[i].key(),
+                                                              w,
+                                                              std::get<0>(this->key_order).begin() );
+            if (success) std::swap(g[ret++], g[i]);
+        }
+        return ret;
+    }
+
+    void restore_generation(Generation&& prev) {
+        for (auto& node : prev) {
+            const std::size_t i = this->find_leaf<0>(0, this->seen_tree.size(), node.key());
+            assert(this->seen_tree.test(i + k_SEEN_TREE_SEEN_FLAG_INDEX));
+            if (!this->seen_tree.test(i + k_SEEN_TREE_CLEARED_FLAG_INDEX)) {
+                this->data.insert(std::move(node));
+            }
+        }
+        prev.clear();
+    }
+
     auto begin() const noexcept {
         return this->data.begin();
     }
@@ -252,15 +541,23 @@ public:
         return this->data.size();
     }
 
+    const SeenTree& get_seen_tree() const noexcept {
+        return this->seen_tree;
+    }
+
 private:
 
-    static std::vector<bool> build_tree(const O& new_key_order) noexcept {
+    static SeenTree build_tree(const O& new_key_order) {
         static_assert(k_SEEN_TREE_ELEMENT_SIZE);
         std::size_t vec_size = k_SEEN_TREE_ELEMENT_SIZE;
 
         const auto op1 = [&vec_size](auto& x){
             for (const auto& e : x) {
-                vec_size *= (ValueHardLimitFn()(e) + 1); // +1 due to having to include zero values of the counter.
+                const std::size_t n = ValueHardLimitFn()(e) + 1; // +1 due to having to include zero values of the counter.
+                if (vec_size > std::numeric_limits<std::size_t>::max() / n) {
+                    throw std::runtime_error("Too many skills and set bonuses for the seen tree.");
+                }
+                vec_size *= n;
             }
         };
         const auto op2 = [&op1](auto&... xv){
@@ -268,7 +565,23 @@ private:
         };
         std::apply(op2, new_key_order);
 
-        return std::vector<bool>(vec_size, false);
+        return SeenTree(vec_size);
+    }
+
+    // Returns the position of k's element in the seen tree.
+    template<std::size_t I>
+    std::size_t find_leaf(std::size_t tree_lo, std::size_t tree_hi, const T& k) const noexcept {
+        for (const auto& e : std::get<I>(this->key_order)) {
+            const std::size_t next_width = (tree_hi - tree_lo) / (ValueHardLimitFn()(e) + 1);
+            tree_lo += std::get<I>(k).get(e) * next_width;
+            tree_hi = tree_lo + next_width;
+        }
+        if constexpr (I + 1 < T_size::value) {
+            return this->find_leaf<I + 1>(tree_lo, tree_hi, k);
+        } else {
+            assert(tree_lo + k_SEEN_TREE_ELEMENT_SIZE == tree_hi);
+            return tree_lo;
+        }
     }
 
     template<std::size_t I>
@@ -278,7 +591,7 @@ private:
                              T& w,
                              const O_iter<I>& p ) {
         assert(tree_lo + k_SEEN_TREE_ELEMENT_SIZE <= tree_hi);
-        if (this->seen_tree[tree_hi - k_SEEN_TREE_ELEMENT_SIZE + k_SEEN_TREE_CLEARED_FLAG_INDEX]) {
+        if (this->seen_tree.test(tree_hi - k_SEEN_TREE_ELEMENT_SIZE + k_SEEN_TREE_CLEARED_FLAG_INDEX)) {
             return false;
         } else if (p == std::get<I>(this->key_order).end()) {
             if constexpr (I + 1 < T_size::value) {
@@ -318,18 +631,18 @@ private:
         (void)tree_hi;
         assert(tree_lo + k_SEEN_TREE_ELEMENT_SIZE == tree_hi); // We must have already found the element we're interested in.
         assert(tree_lo + k_SEEN_TREE_ELEMENT_SIZE <= this->seen_tree.size());
-        assert(!this->seen_tree[tree_lo + k_SEEN_TREE_CLEARED_FLAG_INDEX]); // This was already tested.
-        if (this->seen_tree[tree_lo + k_SEEN_TREE_SEEN_FLAG_INDEX]) {
+        assert(!this->seen_tree.test(tree_lo + k_SEEN_TREE_CLEARED_FLAG_INDEX)); // This was already tested.
+        if (this->seen_tree.test(tree_lo + k_SEEN_TREE_SEEN_FLAG_INDEX)) {
             if (k != w) {
                 // We need this to avoid accidentally deleting data for an input that was already seen.
                 this->data.erase(w);
-                this->seen_tree[tree_lo + k_SEEN_TREE_CLEARED_FLAG_INDEX] = true;
+                this->seen_tree.set(tree_lo + k_SEEN_TREE_CLEARED_FLAG_INDEX);
             }
             return false;
         } else {
-            this->seen_tree[tree_lo + k_SEEN_TREE_SEEN_FLAG_INDEX] = true;
+            this->seen_tree.set(tree_lo + k_SEEN_TREE_SEEN_FLAG_INDEX);
             if (k != w) {
-                this->seen_tree[tree_lo + k_SEEN_TREE_CLEARED_FLAG_INDEX] = true;
+                this->seen_tree.set(tree_lo + k_SEEN_TREE_CLEARED_FLAG_INDEX);
             }
             return true;
         }
@@ -338,6 +651,299 @@ private:
 };
 
 
+
+template<class D, class ValueHardLimitFn, class... Cv>
+using BitTreeCounterSubsetSeenMap = BasicBitTreeCounterSubsetSeenMap<D, ValueHardLimitFn, DenseSeenTree, Cv...>;
+
+
+// Concurrent Bit Tree Counter-Subset-Seen Map
+//
+// A variant of BasicBitTreeCounterSubsetSeenMap that any number of threads can add to at the same time.
+// The seen tree is an array of atomic words (flags are only ever set, using fetch_or()), and the data is
+// split between mutex-guarded shards.
+//
+// Every addition comes with a priority. drain_into() then gives the same result as if each addition was
+// instead made to the destination map one at a time, in ascending order of priority.
+//
+// Until then, concurrent additions can interleave such that a stored key is dominated by another stored
+// key. (A thread can skip over the subsets of a key that another thread is still in the middle of adding.)
+// This never loses a key that isn't dominated by another, so the invariant is restored by drain_into().
+//
+// The destination map's seen tree is read as well as this map's own, so keys the destination map would
+// reject are rejected early. The destination map must therefore not be modified until drain_into().
+//
+// The own seen tree uses dense storage if the destination map's does. Otherwise, it's split into pages that
+// are only allocated when a flag in them is first set (like PagedSeenTree), found through a flat table of
+// page pointers. That only works for trees where PagedSeenTree also uses a flat page table, so check
+// can_hold() first.
+//
+template<class D, class ValueHardLimitFn, class SeenTree, class... Cv>
+class ConcurrentBitTreeCounterSubsetSeenMap {
+    using T = std::tuple<Cv...>;
+    using T_size = std::tuple_size<T>;
+
+    using O = std::tuple<std::vector<typename Cv::key_type>...>;
+
+    template<std::size_t I>
+    using O_iter = typename std::tuple_element<I, O>::type::const_iterator;
+
+    using H = Utils::CounterTupleHash<Cv...>;
+
+    using Serial = BasicBitTreeCounterSubsetSeenMap<D, ValueHardLimitFn, SeenTree, Cv...>;
+
+    using Word = std::uint64_t;
+    static constexpr std::size_t k_WORD_BITS = 64;
+    static_assert(k_WORD_BITS % k_SEEN_TREE_ELEMENT_SIZE == 0); // Elements never straddle words.
+
+    static constexpr std::size_t k_PAGE_WORDS = PagedSeenTree::k_PAGE_WORDS;
+    static constexpr std::size_t k_PAGE_BITS  = PagedSeenTree::k_PAGE_BITS;
+
+    static constexpr std::size_t k_NUM_SHARDS = 64;
+
+    struct Page {
+        std::array<std::atomic<Word>, k_PAGE_WORDS> words;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<T, std::pair<std::size_t, D>, H> data; // Values are (priority, data).
+    };
+
+    // Same as BasicBitTreeCounterSubsetSeenMap.
+    O key_order;
+
+    const SeenTree& dst_seen_tree;
+
+    // Same layout as BasicBitTreeCounterSubsetSeenMap's seen tree, but packed into words.
+    // Exactly one of these is used. Untouched pages are null.
+    std::size_t                     tree_size;
+    std::vector<std::atomic<Word>>  seen_tree;
+    std::vector<std::atomic<Page*>> pages;
+
+    std::vector<Shard> shards;
+
+public:
+
+    // True if a map can be constructed to drain into dst.
+    static bool can_hold(const Serial& dst) noexcept {
+        return dst.seen_tree.uses_dense_storage()
+               || ((dst.seen_tree.size() + k_PAGE_BITS - 1) / k_PAGE_BITS <= PagedSeenTree::k_MAX_FLAT_PAGES);
+    }
+
+    // Constructs an empty map to be drained into dst. (See can_hold().)
+    explicit ConcurrentBitTreeCounterSubsetSeenMap(const Serial& x)
+        : key_order     {x.key_order}
+        , dst_seen_tree {x.seen_tree}
+        , tree_size     {x.seen_tree.size()}
+        , seen_tree     (x.seen_tree.uses_dense_storage() ? ((this->tree_size + k_WORD_BITS - 1) / k_WORD_BITS) : 0)
+        , pages         (x.seen_tree.uses_dense_storage() ? 0 : ((this->tree_size + k_PAGE_BITS - 1) / k_PAGE_BITS))
+        , shards        (k_NUM_SHARDS)
+    {
+        assert(can_hold(x));
+        for (std::atomic<Word>& e : this->seen_tree) {
+            e.store(0, std::memory_order_relaxed);
+        }
+        for (std::atomic<Page*>& e : this->pages) {
+            e.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~ConcurrentBitTreeCounterSubsetSeenMap() {
+        for (std::atomic<Page*>& e : this->pages) {
+            delete e.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Thread-safe. The data object constructor function is only called if needed.
+    template<class StoredDataConstructorFn>
+    void add_using_callback(const StoredDataConstructorFn& d, T&& k, const std::size_t priority) {
+        T w;
+        const bool success = this->add_power_set_inode<0>(0,
+                                                          this->tree_size,
+                                                          k,
+                                                          w,
+                                                          std::get<0>(this->key_order).begin() );
+        // If the same key was already added, we may still have the lower priority.
+        if (success || this->possibly_duplicate(k)) {
+            this->store(d, std::move(k), priority);
+        }
+    }
+
+    // Adds everything to dst, with the same result as if every addition made to this map had instead been
+    // added to dst in ascending order of priority. (For additions of equal priority, the order is arbitrary.)
+    //
+    // dst must be the map this map was constructed from.
+    //
+    // Not thread-safe. All additions must have completed.
+    void drain_into(Serial& dst) && {
+        assert(&dst.seen_tree == &this->dst_seen_tree);
+        std::vector<std::pair<std::size_t, std::pair<T, D>>> all;
+        for (Shard& shard : this->shards) {
+            while (shard.data.size()) {
+                auto node = shard.data.extract(shard.data.begin());
+                all.emplace_back(node.mapped().first,
+                                 std::make_pair(std::move(node.key()), std::move(node.mapped().second)));
+            }
+        }
+        const auto cmp = [](const auto& a, const auto& b){
+            return a.first < b.first;
+        };
+        std::sort(all.begin(), all.end(), cmp);
+        for (auto& e : all) {
+            dst.add(std::move(e.second.second), std::move(e.second.first));
+        }
+    }
+
+private:
+
+    // Returns the word holding bit i, or nullptr if it's in an untouched page.
+    const std::atomic<Word>* find_word(const std::size_t i) const noexcept {
+        assert(i < this->tree_size);
+        if (this->seen_tree.size()) return &this->seen_tree[i / k_WORD_BITS];
+        // Acquire, so that a page allocated by another thread is seen zeroed.
+        const Page * const page = this->pages[i / k_PAGE_BITS].load(std::memory_order_acquire);
+        return page ? &page->words[(i % k_PAGE_BITS) / k_WORD_BITS] : nullptr;
+    }
+
+    // Same as find_word(), but allocates the page if it's untouched.
+    std::atomic<Word>& get_word(const std::size_t i) {
+        assert(i < this->tree_size);
+        if (this->seen_tree.size()) return this->seen_tree[i / k_WORD_BITS];
+        std::atomic<Page*>& entry = this->pages[i / k_PAGE_BITS];
+        Page * page = entry.load(std::memory_order_acquire);
+        if (!page) {
+            Page * const new_page = new Page(); // Value-initialized, so all flags are false.
+            // If another thread allocated the page first, we use theirs instead.
+            if (entry.compare_exchange_strong(page, new_page, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                page = new_page;
+            } else {
+                delete new_page;
+            }
+        }
+        return page->words[(i % k_PAGE_BITS) / k_WORD_BITS];
+    }
+
+    // Flags are only hints about which keys were added. Every flag that is set reflects an addition that
+    // really happened, so relaxed ordering is enough. (The data itself is protected by the shard mutexes.)
+    //
+    // The destination map's flags are included. They don't change until drain_into().
+    bool test_flag(const std::size_t i) const noexcept {
+        if (this->dst_seen_tree.test(i)) return true;
+        const std::atomic<Word> * const word = this->find_word(i);
+        return word && ((word->load(std::memory_order_relaxed) >> (i % k_WORD_BITS)) & 1);
+    }
+
+    // Sets the flags of the element starting at bit i, and returns the element's previous flags.
+    Word fetch_or_element(const std::size_t i, const Word flags) {
+        assert(i % k_SEEN_TREE_ELEMENT_SIZE == 0);
+        const std::size_t shift = i % k_WORD_BITS;
+        const Word old = this->get_word(i).fetch_or(flags << shift, std::memory_order_relaxed);
+        return old >> shift;
+    }
+
+    Shard& get_shard(const T& k) noexcept {
+        return this->shards[(H()(k) >> 16) % k_NUM_SHARDS];
+    }
+
+    template<class StoredDataConstructorFn>
+    void store(const StoredDataConstructorFn& d, T&& k, const std::size_t priority) {
+        Shard& shard = this->get_shard(k);
+        std::lock_guard<std::mutex> lock (shard.mutex);
+        const auto result = shard.data.find(k);
+        if (result == shard.data.end()) {
+            shard.data.emplace(std::move(k), std::make_pair(priority, d()));
+        } else if (priority < result->second.first) {
+            result->second = std::make_pair(priority, d());
+        }
+    }
+
+    void erase(const T& k) {
+        Shard& shard = this->get_shard(k);
+        std::lock_guard<std::mutex> lock (shard.mutex);
+        shard.data.erase(k);
+    }
+
+    // True if k itself was seen but was never known to be dominated.
+    bool possibly_duplicate(const T& k) const noexcept {
+        std::size_t tree_lo = 0;
+        std::size_t width = this->tree_size;
+        const auto op1 = [&](const auto& keys, const auto& counter){
+            for (const auto& e : keys) {
+                width /= (ValueHardLimitFn()(e) + 1);
+                tree_lo += counter.get(e) * width;
+            }
+        };
+        const auto op2 = [&](const auto&... counters){
+            const auto op3 = [&](const auto&... keys){
+                (op1(keys, counters), ...);
+            };
+            std::apply(op3, this->key_order);
+        };
+        std::apply(op2, k);
+        assert(width == k_SEEN_TREE_ELEMENT_SIZE);
+        return this->test_flag(tree_lo + k_SEEN_TREE_SEEN_FLAG_INDEX)
+               && !this->test_flag(tree_lo + k_SEEN_TREE_CLEARED_FLAG_INDEX);
+    }
+
+    // Same as BasicBitTreeCounterSubsetSeenMap.
+    template<std::size_t I>
+    bool add_power_set_inode(const std::size_t tree_lo,
+                             const std::size_t tree_hi,
+                             const T& k,
+                             T& w,
+                             const O_iter<I>& p ) {
+        assert(tree_lo + k_SEEN_TREE_ELEMENT_SIZE <= tree_hi);
+        if (this->test_flag(tree_hi - k_SEEN_TREE_ELEMENT_SIZE + k_SEEN_TREE_CLEARED_FLAG_INDEX)) {
+            return false;
+        } else if (p == std::get<I>(this->key_order).end()) {
+            if constexpr (I + 1 < T_size::value) {
+                return this->add_power_set_inode<I + 1>(tree_lo, tree_hi, k, w, std::get<I + 1>(this->key_order).begin());
+            } else {
+                return this->add_power_set_leafnode(tree_lo, tree_hi, k, w);
+            }
+        } else {
+            const unsigned int max_v = ValueHardLimitFn()(*p);
+            const unsigned int v = std::get<I>(k).get(*p);
+            const std::size_t next_width = (tree_hi - tree_lo) / (max_v + 1);
+            assert(v <= max_v);
+            {
+                unsigned int i = v;
+                do {
+                    std::get<I>(w).set_or_remove(*p, i);
+                    const std::size_t next_tree_lo = tree_lo + (i * next_width);
+                    const std::size_t next_tree_hi = next_tree_lo + next_width;
+                    const bool success = this->add_power_set_inode<I>(next_tree_lo, next_tree_hi, k, w, p + 1);
+                    if (!success) {
+                        return (i != v) && (v > 0);
+                    }
+                } while (i-- > 0);
+            }
+            assert(!std::get<I>(w).contains(*p));
+            return true;
+        }
+    }
+
+    bool add_power_set_leafnode(const std::size_t tree_lo,
+                                const std::size_t tree_hi,
+                                const T& k,
+                                T& w ) {
+        (void)tree_hi;
+        assert(tree_lo + k_SEEN_TREE_ELEMENT_SIZE == tree_hi);
+        const bool is_k = (k == w);
+        const Word flags = (Word(1) << k_SEEN_TREE_SEEN_FLAG_INDEX)
+                           | (is_k ? 0 : (Word(1) << k_SEEN_TREE_CLEARED_FLAG_INDEX));
+        const Word old_flags = this->fetch_or_element(tree_lo, flags);
+        if ((old_flags & (Word(1) << k_SEEN_TREE_SEEN_FLAG_INDEX))
+                || this->dst_seen_tree.test(tree_lo + k_SEEN_TREE_SEEN_FLAG_INDEX)) {
+            if (!is_k) this->erase(w);
+            return false;
+        }
+        return true;
+    }
+
+};
+
+
 } // namespace
 
 
@@ -0,0 +1,184 @@
+/*
+ * File: pareto_index.h
+ * Author: <contact@simshadows.com>
+ *
+ * An automatically-pruned data structure, like PruningVector, but indexed so that each
+ * insertion only needs to compare against the stored elements that could possibly prune it
+ * (or be pruned by it).
+ *
+ * After every insertion, the contents are identical to what PruningVector would hold after
+ * the same sequence of insertions. underlying() also returns elements in the same order.
+ *
+ * class T:
+ *      Container data.
+ *
+ * class CanReplaceFn:
+ *      Same as for PruningVector.
+ *
+ * class IndexFn:
+ *      A standalone function object:
+ *          struct MyIndexFn {
+ *              using Partition = ...; // Must be usable as a std::map key.
+ *
+ *              Partition partition(const T&) const;
+ *              bool partition_can_replace(const Partition& left, const Partition& right) const;
+ *              double key(const T&) const;
+ *          };
+ *      partition_can_replace() must return true if it's possible for any element in the left
+ *      partition to prune out any element in the right partition.
+ *      If CanReplaceFn()(left, right) is true, key(left) >= key(right) must also be true.
+ *
+ *      The index works best when there are few partitions, and the key spreads elements out.
+ */
+
+#ifndef PARETO_INDEX_H
+#define PARETO_INDEX_H
+
+#include <assert.h>
+#include <algorithm>
+#include <map>
+#include <vector>
+
+namespace Utils {
+
+
+template<class T, class CanReplaceFn, class IndexFn>
+class ParetoIndex {
+    using Partition = typename IndexFn::Partition;
+
+    struct Entry {
+        double      key;
+        std::size_t seq; // Insertion order.
+        T           value;
+    };
+
+    struct PartitionData {
+        // Sorted by descending key.
+        std::vector<Entry> entries;
+
+        // Indices of partitions whose elements might prune out elements of this one, and vice versa.
+        // Both include this partition itself.
+        std::vector<std::size_t> replaced_by;
+        std::vector<std::size_t> replaces;
+    };
+
+    std::map<Partition, std::size_t> partition_indices;
+    std::vector<PartitionData>       partitions;
+
+    std::size_t next_seq;
+    std::size_t num_elements;
+public:
+    ParetoIndex() noexcept
+        : partition_indices {}
+        , partitions        {}
+        , next_seq          {0}
+        , num_elements      {0}
+    {
+    }
+
+    void try_push_back(T&& t) {
+        const std::size_t p = this->get_partition(IndexFn().partition(t));
+        const double key = IndexFn().key(t);
+
+        // Figure out if existing data prunes out t.
+        // Only elements with at least the same key can, and we expect the closest keys to be the most likely.
+        for (const std::size_t i : this->partitions[p].replaced_by) {
+            const std::vector<Entry>& entries = this->partitions[i].entries;
+            auto e = std::upper_bound(entries.begin(), entries.end(), key, key_cmp);
+            while (e != entries.begin()) {
+                --e;
+                if (CanReplaceFn()(e->value, t)) return;
+            }
+        }
+
+        // Prune away all existing data that t is able to replace.
+        for (const std::size_t i : this->partitions[p].replaces) {
+            std::vector<Entry>& entries = this->partitions[i].entries;
+            const auto lo = std::lower_bound(entries.begin(), entries.end(), key, key_cmp);
+            const auto pred = [&](const Entry& d) {
+                return CanReplaceFn()(t, d.value);
+            };
+            const auto new_end = std::remove_if(lo, entries.end(), pred);
+            this->num_elements -= std::distance(new_end, entries.end());
+            entries.erase(new_end, entries.end());
+        }
+
+        // Add data
+        std::vector<Entry>& entries = this->partitions[p].entries;
+        const auto pos = std::lower_bound(entries.begin(), entries.end(), key, key_cmp);
+        entries.insert(pos, {key, this->next_seq++, std::move(t)});
+        ++this->num_elements;
+    }
+
+    // Elements are returned in the order they were inserted.
+    std::vector<T> underlying() const {
+        std::vector<const Entry*> all;
+        all.reserve(this->num_elements);
+        for (const PartitionData& x : this->partitions) {
+            for (const Entry& e : x.entries) {
+                all.emplace_back(&e);
+            }
+        }
+        const auto cmp = [](const Entry* const a, const Entry* const b){
+            return a->seq < b->seq;
+        };
+        std::sort(all.begin(), all.end(), cmp);
+
+        std::vector<T> ret;
+        ret.reserve(all.size());
+        for (const Entry * const e : all) {
+            ret.emplace_back(e->value);
+        }
+        return ret;
+    }
+
+    std::size_t size() const noexcept {
+        return this->num_elements;
+    }
+
+private:
+
+    // Orders entries by descending key. Used for both std::lower_bound() and std::upper_bound().
+    struct KeyCmp {
+        bool operator()(const Entry& e, const double key) const noexcept {
+            return e.key > key;
+        }
+        bool operator()(const double key, const Entry& e) const noexcept {
+            return key > e.key;
+        }
+    };
+    static constexpr KeyCmp key_cmp {};
+
+    std::size_t get_partition(Partition&& partition) {
+        const auto result = this->partition_indices.find(partition);
+        if (result != this->partition_indices.end()) return result->second;
+
+        const std::size_t p = this->partitions.size();
+        this->partitions.emplace_back();
+        PartitionData& data = this->partitions.back();
+
+        // Searching a partition's own entries first tends to find pruning elements sooner.
+        data.replaced_by.emplace_back(p);
+        data.replaces.emplace_back(p);
+        for (const auto& e : this->partition_indices) {
+            const std::size_t i = e.second;
+            if (IndexFn().partition_can_replace(e.first, partition)) {
+                data.replaced_by.emplace_back(i);
+                this->partitions[i].replaces.emplace_back(p);
+            }
+            if (IndexFn().partition_can_replace(partition, e.first)) {
+                data.replaces.emplace_back(i);
+                this->partitions[i].replaced_by.emplace_back(p);
+            }
+        }
+
+        this->partition_indices.emplace(std::move(partition), p);
+        return p;
+    }
+};
+
+
+} // namespace
+
+#endif // PARETO_INDEX_H
+
@@ -8,6 +8,9 @@
  * TODO: This probably doesn't deserve to be its own class. I should probably reimplement
  *       this as a standalone function.
  *
+ * For large inputs, see ParetoIndex (pareto_index.h), which produces identical results.
+ * (This version is still a suitable model for testing ParetoIndex.)
+ *
  * class T:
  *      Container data.
  *
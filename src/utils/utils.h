@@ -8,6 +8,8 @@
 
 #include <assert.h>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <unordered_set>
 #include <unordered_map>
 
@@ -23,6 +25,15 @@ inline unsigned int ceil_div(const unsigned int n, const unsigned int d) {
     return (n + d - 1) / d;
 }
 
+// 64-bit FNV-1a. Pass a previous result as h to continue hashing more data.
+inline std::uint64_t fnv1a_64(const void* data, const std::size_t size, std::uint64_t h=0xcbf29ce484222325ull) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    return h;
+}
+
 //inline bool equal_within_2decpl(const double a, const double b) {
 //    return std::round(a * 100) == std::round(b * 100);
 //}
@@ -35,7 +35,8 @@ namespace MiscBuffsDatabase
 
 using MHWIBuildSearch::MiscBuff;
 
-const MiscBuff& get_miscbuff(const std::string& miscbuff_id) noexcept;
+// Throws std::out_of_range if the ID doesn't exist.
+const MiscBuff& get_miscbuff(const std::string& miscbuff_id);
 
 } // namespace
 
@@ -50,6 +51,7 @@ CPP_BASE = """
  * Do not edit directly!
  */
 
+#include <stdexcept>
 #include <unordered_map>
 
 #include "../database_miscbuffs.h"
@@ -63,8 +65,12 @@ static const std::unordered_map<std::string, MiscBuff> g_miscbuffs_map = {{
 }};
 
 
-const MiscBuff& get_miscbuff(const std::string& miscbuff_id) noexcept {{
-    return g_miscbuffs_map.at(miscbuff_id);
+const MiscBuff& get_miscbuff(const std::string& miscbuff_id) {{
+    try {{
+        return g_miscbuffs_map.at(miscbuff_id);
+    }} catch (const std::out_of_range&) {{
+        throw std::out_of_range("Misc buff ID '" + miscbuff_id + "' not found in the database.");
+    }}
 }}
 
 
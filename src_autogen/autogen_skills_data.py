@@ -40,13 +40,20 @@ using MHWIBuildSearch::SetBonus;
 
 {skill_nids}
 
+constexpr std::size_t g_num_skills = {num_skills};
+
 {setbonus_declarations}
 
+// Indexed by Skill::nid.
+extern const std::array<const Skill*, g_num_skills> g_all_skills;
+
 extern const std::array<const SetBonus*, {num_setbonuses}> g_all_setbonuses;
 
-const Skill* get_skill(const std::string& skill_id) noexcept;
+// Throws std::out_of_range if the ID doesn't exist.
+const Skill* get_skill(const std::string& skill_id);
 
-const SetBonus* get_setbonus(const std::string& setbonus_id) noexcept;
+// Throws std::out_of_range if the ID doesn't exist.
+const SetBonus* get_setbonus(const std::string& setbonus_id);
 
 }} // namespace
 
@@ -61,6 +68,7 @@ SKILLS_CPP_BASE = """
  * Do not edit directly!
  */
 
+#include <stdexcept>
 #include <unordered_map>
 
 #include "../database_skills.h"
@@ -85,18 +93,31 @@ static const std::unordered_map<std::string, const SetBonus*> g_setbonus_map = {
 }};
 
 
+const std::array<const Skill*, g_num_skills> g_all_skills = {{
+{skill_array_elements}
+}};
+
+
 const std::array<const SetBonus*, {num_setbonuses}> g_all_setbonuses = {{
 {setbonus_array_elements}
 }};
 
 
-const Skill* get_skill(const std::string& skill_id) noexcept {{
-    return g_skills_map.at(skill_id);
+const Skill* get_skill(const std::string& skill_id) {{
+    try {{
+        return g_skills_map.at(skill_id);
+    }} catch (const std::out_of_range&) {{
+        throw std::out_of_range("Skill ID '" + skill_id + "' not found in the database.");
+    }}
 }}
 
 
-const SetBonus* get_setbonus(const std::string& setbonus_id) noexcept {{
-    return g_setbonus_map.at(setbonus_id);
+const SetBonus* get_setbonus(const std::string& setbonus_id) {{
+    try {{
+        return g_setbonus_map.at(setbonus_id);
+    }} catch (const std::out_of_range&) {{
+        throw std::out_of_range("Set bonus ID '" + setbonus_id + "' not found in the database.");
+    }}
 }}
 
 
@@ -190,6 +211,7 @@ def generate_skills_source():
     skill_nids         = []
     skill_definitions  = []
     skill_map_elements = []
+    skill_array_elements = []
 
     setbonus_declarations   = []
     setbonus_definitions    = []
@@ -218,6 +240,9 @@ def generate_skills_source():
         skill_map_elements.append(
                     f"    {{ \"{skill['skill_id']}\", &{skill['identifier']} }},"
                 )
+        skill_array_elements.append(
+                    f"    &{skill['identifier']},"
+                )
         next_nid += 1
 
     for (_, setbonus) in setbonuses.items():
@@ -252,6 +277,7 @@ def generate_skills_source():
     h_file_data = SKILLS_H_BASE.format(
             skill_declarations="\n".join(skill_declarations),
             skill_nids="\n".join(skill_nids),
+            num_skills=next_nid,
             setbonus_declarations="\n".join(setbonus_declarations),
             num_setbonuses=num_setbonuses,
         )
@@ -261,6 +287,7 @@ def generate_skills_source():
             skill_definitions="\n\n".join(skill_definitions),
             setbonus_definitions="\n\n".join(setbonus_definitions),
             skill_map_elements="\n".join(skill_map_elements),
+            skill_array_elements="\n".join(skill_array_elements),
             setbonus_map_elements="\n".join(setbonus_map_elements),
             setbonus_array_elements="\n".join(setbonus_array_elements),
             num_setbonuses=num_setbonuses,
@@ -8,6 +8,11 @@
 #define CATCH_CONFIG_MAIN
 #include "../dependencies/catch-2-12-2/catch.hpp"
 
+#include <filesystem>
+#include <map>
+#include <random>
+#include <set>
+#include <thread>
 #include <unordered_map>
 
 #include "../src/core/core.h"
@@ -16,6 +21,9 @@
 #include "../src/database/database_skills.h"
 #include "../src/support/support.h"
 #include "../src/utils/utils.h"
+#include "../src/utils/counter_subset_seen_map.h"
+#include "../src/utils/pareto_index.h"
+#include "../src/utils/pruning_vector.h"
 
 namespace TestMHWIBuildSearch
 {
@@ -441,6 +449,86 @@ TEST_CASE("Testing unusual skill combinations.") {
 }
 
 
+TEST_CASE("WeaponBatch matches the scalar calculations.") {
+
+    std::unordered_map<const Skill*, unsigned int> min_levels = {
+        {&SkillsDatabase::g_skill_agitator, 0},
+        {&SkillsDatabase::g_skill_weakness_exploit, 0},
+        {&SkillsDatabase::g_skill_frostcraft, 0},
+    };
+    std::unordered_map<const Skill*, unsigned int> forced_states = {
+        {&SkillsDatabase::g_skill_weakness_exploit, 1},
+    };
+    MiscBuffsEquips misc_buffs ({
+        &MiscBuffsDatabase::get_miscbuff("POWERCHARM"),
+        &MiscBuffsDatabase::get_miscbuff("POWERTALON"),
+    });
+    SkillSpec skill_spec(std::move(min_levels), std::move(forced_states), {});
+
+    DamageModel model;
+    model.raw_motion_value   = 264;
+    model.elemental_modifier = 1.0;
+    model.status_modifier    = 1.0;
+    model.hzv_raw            = 60;
+    model.hzv_fire           = 25;
+    model.hzv_water          = 20;
+    model.hzv_thunder        = 15;
+    model.hzv_ice            = 10;
+    model.hzv_dragon         = 5;
+    model.poison_total_procs = 2;
+    model.poison_proc_dmg    = 160;
+    model.blast_base         = 102;
+    model.blast_buildup      = 69;
+    model.blast_cap          = 1541;
+    model.blast_proc_dmg     = 300;
+    model.target_health      = 24000;
+
+    std::vector<SkillMap> skill_maps (4);
+    skill_maps[1].set(&SkillsDatabase::g_skill_handicraft, 3);
+    skill_maps[1].set(&SkillsDatabase::g_skill_bludgeoner, 1);
+    skill_maps[1].set(&SkillsDatabase::g_skill_non_elemental_boost, 1);
+    skill_maps[2].set(&SkillsDatabase::g_skill_free_elem_ammo_up, 2);
+    skill_maps[2].set(&SkillsDatabase::g_skill_critical_boost, 3);
+    skill_maps[2].set(&SkillsDatabase::g_skill_agitator, 2);
+    skill_maps[3].set(&SkillsDatabase::g_skill_handicraft, 5);
+    skill_maps[3].set(&SkillsDatabase::g_skill_frostcraft, 1);
+    skill_maps[3].set(&SkillsDatabase::g_skill_weakness_exploit, 3);
+    // Only differs from the previous skill map in skills that don't affect damage.
+    skill_maps.emplace_back(skill_maps[3]);
+    skill_maps[4].set(&SkillsDatabase::g_skill_divine_blessing, 3);
+
+    std::vector<WeaponContribution> contributions;
+    WeaponBatch batch (WeaponClass::greatsword);
+    for (const Weapon * const weapon : db.weapons.get_all_of_weaponclass(WeaponClass::greatsword)) {
+        contributions.emplace_back(WeaponInstance(weapon).calculate_contribution());
+        batch.push_back(contributions.back());
+    }
+    REQUIRE(batch.size() == contributions.size());
+
+    SharedSkillContributionCache sc_cache (skill_spec, WeaponClass::greatsword);
+    std::vector<double> total_damages;
+    std::vector<double> cached_total_damages;
+    for (const SkillMap& skills : skill_maps) {
+        batch.calculate_total_damage(skills, misc_buffs, skill_spec, model, total_damages);
+        REQUIRE(total_damages.size() == contributions.size());
+        batch.calculate_total_damage(sc_cache.get(skills), misc_buffs, model, cached_total_damages);
+        REQUIRE(cached_total_damages == total_damages);
+        for (std::size_t i = 0; i < contributions.size(); ++i) {
+            const EffectiveDamageValues edv = calculate_edv_from_skills_lookup(WeaponClass::greatsword,
+                                                                               contributions[i],
+                                                                               skills,
+                                                                               misc_buffs,
+                                                                               skill_spec);
+            const ModelCalculatedValues mcv = calculate_damage(model, edv);
+            REQUIRE(total_damages[i] == mcv.unrounded_total_damage);
+        }
+    }
+    // Every lookup is either a hit or a miss, and skill maps differing only in non-contributing skills share an entry.
+    REQUIRE(sc_cache.get_stat_hits() + sc_cache.get_stat_misses() == skill_maps.size());
+    REQUIRE(sc_cache.get_stat_hits() > 0);
+}
+
+
 TEST_CASE("DecoEquips::fits()") {
 
     std::unordered_map<const Skill*, unsigned int> min_levels = {
@@ -522,5 +610,482 @@ TEST_CASE("DecoEquips::fits()") {
 }
 
 
+TEST_CASE("SkillMap") {
+
+    const Skill* const agitator       = &SkillsDatabase::g_skill_agitator;
+    const Skill* const agitator_s     = &SkillsDatabase::g_skill_agitator_secret;
+    const Skill* const weakness_expl  = &SkillsDatabase::g_skill_weakness_exploit;
+    const Skill* const windproof      = &SkillsDatabase::g_skill_windproof; // Highest nid.
+
+    SECTION("Clipping, merging and iteration") {
+        SkillMap a;
+        a.set(agitator, 4);
+        a.set(weakness_expl, 2);
+        a.set(windproof, 1);
+
+        SkillMap b;
+        b.set(agitator, 5);
+        b.set(agitator_s, 1);
+        b.set(weakness_expl, 2);
+
+        a.merge_in(b);
+        REQUIRE(a.get(agitator) == 7);      // Clipped to secret_limit.
+        REQUIRE(a.get(agitator_s) == 1);
+        REQUIRE(a.get(weakness_expl) == 3); // Clipped to secret_limit.
+        REQUIRE(a.get(windproof) == 1);
+        REQUIRE(a.size() == 4);
+        REQUIRE(a.sum() == 12);
+        REQUIRE(a.get_non_secret(agitator, agitator_s) == 7);
+
+        a.remove(agitator_s);
+        REQUIRE(!a.contains(agitator_s));
+        REQUIRE(a.get_non_secret(agitator, agitator_s) == 5);
+
+        std::vector<std::pair<const Skill*, unsigned int>> contents;
+        for (const auto& e : a) contents.emplace_back(e);
+        REQUIRE(contents.size() == 3);
+        REQUIRE(contents[0].first == agitator);
+        REQUIRE(contents[2].first == windproof);
+    }
+
+    SECTION("Equality and hashing") {
+        SkillMap a;
+        a.set(agitator, 3);
+        SkillMap b;
+        b.increment(agitator, 1);
+        b.increment(agitator, 2);
+        REQUIRE(a == b);
+        REQUIRE(a.calculate_hash() == b.calculate_hash());
+
+        b.decrement(agitator, 3);
+        REQUIRE(b == SkillMap());
+        REQUIRE(a != b);
+    }
+
+}
+
+
+TEST_CASE("PackedSkills") {
+
+    std::unordered_map<const Skill*, unsigned int> min_levels = {
+        {&SkillsDatabase::g_skill_agitator, 5},
+        {&SkillsDatabase::g_skill_agitator_secret, 0},
+        {&SkillsDatabase::g_skill_weakness_exploit, 0},
+        {&SkillsDatabase::g_skill_critical_boost, 0},
+    };
+    std::unordered_map<const Skill*, unsigned int> forced_states;
+    SkillSpec skill_spec(std::move(min_levels), std::move(forced_states), {});
+
+    const SetBonus* const set_bonus = SkillsDatabase::g_all_setbonuses.front();
+    const SkillLayout layout(skill_spec, {{set_bonus, 3}});
+
+    SECTION("Merging clips every field, as SkillMap does") {
+        // Exhaustively compare against SkillMap over a few levels of each skill.
+        for (unsigned int a = 0; a <= 7; ++a) {
+            for (unsigned int b = 0; b <= 7; ++b) {
+                SkillMap x;
+                SkillMap y;
+                x.set_or_remove(&SkillsDatabase::g_skill_agitator, a);
+                x.set_or_remove(&SkillsDatabase::g_skill_weakness_exploit, b);
+                y.set_or_remove(&SkillsDatabase::g_skill_agitator, b);
+                y.set_or_remove(&SkillsDatabase::g_skill_critical_boost, a);
+                y.set_or_remove(&SkillsDatabase::g_skill_weakness_exploit, a);
+
+                PackedSkills px = layout.pack(x);
+                px.merge_in(layout.pack(y), layout);
+                x.merge_in(y);
+                REQUIRE(px == layout.pack(x));
+                REQUIRE(layout.unpack_skills(px) == x);
+            }
+        }
+
+        SetBonusMap sb;
+        sb.set(set_bonus, 2);
+        PackedSkills px = layout.pack({}, sb);
+        px.merge_in(px, layout);
+        REQUIRE(px.get(layout.field(set_bonus)) == 3); // Clipped to the highest pieces worth counting.
+    }
+
+    SECTION("Dominance and minimum requirements") {
+        SkillMap x;
+        x.set(&SkillsDatabase::g_skill_agitator, 5);
+        x.set(&SkillsDatabase::g_skill_weakness_exploit, 1);
+        SkillMap y = x;
+        y.set(&SkillsDatabase::g_skill_critical_boost, 1);
+
+        REQUIRE(layout.meets_minimum_requirements(layout.pack(x)));
+        REQUIRE(layout.pack(y).dominates(layout.pack(x), layout));
+        REQUIRE(!layout.pack(x).dominates(layout.pack(y), layout));
+
+        x.set(&SkillsDatabase::g_skill_agitator, 4);
+        REQUIRE(!layout.meets_minimum_requirements(layout.pack(x)));
+        REQUIRE(skill_spec.skills_meet_minimum_requirements(x) == layout.meets_minimum_requirements(layout.pack(x)));
+    }
+
+    SECTION("Field maximums, sums and set bonuses") {
+        SkillMap x;
+        x.set(&SkillsDatabase::g_skill_agitator, 5);
+        x.set(&SkillsDatabase::g_skill_weakness_exploit, 1);
+        SkillMap y;
+        y.set(&SkillsDatabase::g_skill_agitator, 2);
+        y.set(&SkillsDatabase::g_skill_critical_boost, 3);
+        SetBonusMap sb;
+        sb.set(set_bonus, 2);
+
+        const PackedSkills m = layout.field_max(layout.pack(x, sb), layout.pack(y));
+        REQUIRE(m.get(layout.field(&SkillsDatabase::g_skill_agitator)) == 5);
+        REQUIRE(m.get(layout.field(&SkillsDatabase::g_skill_weakness_exploit)) == 1);
+        REQUIRE(m.get(layout.field(&SkillsDatabase::g_skill_critical_boost)) == 3);
+        REQUIRE(layout.sum(m) == 11);
+        REQUIRE(layout.unpack_set_bonuses(m).get(set_bonus) == 2);
+        REQUIRE(layout.contains(set_bonus));
+    }
+
+}
+
+
+// Points with a category. Left prunes right if they're in the same category (or right has no category),
+// and left has at least as much in every dimension.
+using TestPoint = std::array<int, 4>; // Category, followed by three dimensions.
+
+struct TestPointPruneFn {
+    bool operator()(const TestPoint& l, const TestPoint& r) const noexcept {
+        if (r[0] && (l[0] != r[0])) return false;
+        return (l[1] >= r[1]) && (l[2] >= r[2]) && (l[3] >= r[3]);
+    }
+};
+
+struct TestPointIndexFn {
+    using Partition = int;
+    Partition partition(const TestPoint& x) const noexcept {
+        return x[0];
+    }
+    bool partition_can_replace(const Partition& l, const Partition& r) const noexcept {
+        return (!r) || (l == r);
+    }
+    double key(const TestPoint& x) const noexcept {
+        return x[1] + x[2] + x[3];
+    }
+};
+
+
+TEST_CASE("ParetoIndex matches PruningVector") {
+    std::mt19937 rng (12345);
+    for (const int range : {3, 8, 50}) {
+        std::uniform_int_distribution<int> category (0, 3);
+        std::uniform_int_distribution<int> value (0, range);
+
+        Utils::PruningVector<TestPoint, TestPointPruneFn> expected;
+        Utils::ParetoIndex<TestPoint, TestPointPruneFn, TestPointIndexFn> actual;
+        for (int i = 0; i < 3000; ++i) {
+            const TestPoint x = {category(rng), value(rng), value(rng), value(rng)};
+            expected.try_push_back(TestPoint(x));
+            actual.try_push_back(TestPoint(x));
+        }
+        REQUIRE(actual.size() == expected.size());
+        REQUIRE(actual.underlying() == expected.underlying());
+    }
+}
+
+
+
+struct SkillSecretLimitFn {
+    unsigned int operator()(const Skill * const skill) const noexcept {
+        return skill->secret_limit;
+    }
+};
+
+
+TEST_CASE("ConcurrentBitTreeCounterSubsetSeenMap matches BitTreeCounterSubsetSeenMap") {
+    const std::vector<const Skill*> skills = {&SkillsDatabase::g_skill_attack_boost,
+                                              &SkillsDatabase::g_skill_critical_eye,
+                                              &SkillsDatabase::g_skill_critical_boost,
+                                              &SkillsDatabase::g_skill_handicraft };
+
+    std::mt19937 rng (12345);
+    std::vector<SkillMap> keys;
+    for (std::size_t i = 0; i < 5000; ++i) {
+        SkillMap k;
+        for (const Skill * const skill : skills) {
+            std::uniform_int_distribution<unsigned int> value (0, skill->secret_limit);
+            k.set_or_remove(skill, value(rng));
+        }
+        keys.emplace_back(std::move(k));
+    }
+
+    // The first keys are added to the destination map before the concurrent map is constructed from it.
+    const auto check = [&](auto seen_tree_tag, const std::size_t num_initial){
+        using SeenTree = decltype(seen_tree_tag);
+        using SeenMap = Utils::BasicBitTreeCounterSubsetSeenMap<std::size_t, SkillSecretLimitFn, SeenTree, SkillMap>;
+        using ConcurrentSeenMap = Utils::ConcurrentBitTreeCounterSubsetSeenMap<std::size_t,
+                                                                              SkillSecretLimitFn,
+                                                                              SeenTree,
+                                                                              SkillMap>;
+
+        SeenMap expected (skills);
+        for (std::size_t i = 0; i < keys.size(); ++i) {
+            expected.add(std::size_t(i), std::make_tuple(keys[i]));
+        }
+
+        SeenMap actual = expected.clone_empty();
+        for (std::size_t i = 0; i < num_initial; ++i) {
+            actual.add(std::size_t(i), std::make_tuple(keys[i]));
+        }
+        REQUIRE(ConcurrentSeenMap::can_hold(actual));
+        ConcurrentSeenMap concurrent (actual);
+        std::vector<std::thread> threads;
+        for (std::size_t t = 0; t < 4; ++t) {
+            threads.emplace_back([&, t](){
+                for (std::size_t i = num_initial + t; i < keys.size(); i += 4) {
+                    concurrent.add_using_callback([i](){return i;}, std::make_tuple(keys[i]), i);
+                }
+            });
+        }
+        for (std::thread& t : threads) {
+            t.join();
+        }
+        std::move(concurrent).drain_into(actual);
+
+        // Data is unique, so we can match up entries by their data.
+        const auto by_data = [](const SeenMap& x){
+            std::map<std::size_t, SkillMap> ret;
+            for (const auto& e : x) {
+                ret.emplace(e.second, std::get<0>(e.first));
+            }
+            return ret;
+        };
+        REQUIRE(actual.size() == expected.size());
+        REQUIRE(by_data(actual) == by_data(expected));
+    };
+    for (const std::size_t num_initial : {std::size_t(0), std::size_t(1000)}) {
+        check(Utils::DenseSeenTree(0), num_initial);
+        check(Utils::PagedSeenTree(0), num_initial);
+    }
+}
+
+
+TEST_CASE("PagedSeenTree") {
+    // Small enough for a flat page table, and large enough to need the hashed page lookup.
+    for (const std::size_t size : {std::size_t(100000), std::size_t(1) << 40}) {
+        Utils::PagedSeenTree tree (size);
+        REQUIRE(tree.size() == size);
+
+        std::mt19937_64 rng (size);
+        std::uniform_int_distribution<std::size_t> index (0, size - 1);
+        std::set<std::size_t> expected;
+        for (std::size_t i = 0; i < 5000; ++i) {
+            // Clustered indices exercise bits sharing pages and words.
+            const std::size_t base = index(rng);
+            for (std::size_t j = base; j < std::min(base + 3, size); ++j) {
+                tree.set(j);
+                expected.emplace(j);
+            }
+        }
+        for (const std::size_t i : expected) {
+            REQUIRE(tree.test(i));
+        }
+        for (std::size_t i = 0; i < 5000; ++i) {
+            const std::size_t j = index(rng);
+            REQUIRE(tree.test(j) == (expected.count(j) == 1));
+        }
+    }
+
+    // A map using paged storage must behave identically to one using dense storage.
+    using DenseMap = Utils::BitTreeCounterSubsetSeenMap<std::size_t, SkillSecretLimitFn, SkillMap>;
+    using PagedMap = Utils::BasicBitTreeCounterSubsetSeenMap<std::size_t,
+                                                             SkillSecretLimitFn,
+                                                             Utils::PagedSeenTree,
+                                                             SkillMap>;
+    const std::vector<const Skill*> skills = {&SkillsDatabase::g_skill_attack_boost,
+                                              &SkillsDatabase::g_skill_critical_eye,
+                                              &SkillsDatabase::g_skill_weakness_exploit,
+                                              &SkillsDatabase::g_skill_handicraft };
+    DenseMap dense (skills);
+    PagedMap paged (skills);
+    std::mt19937 rng (54321);
+    for (std::size_t i = 0; i < 5000; ++i) {
+        SkillMap k;
+        for (const Skill * const skill : skills) {
+            std::uniform_int_distribution<unsigned int> value (0, skill->secret_limit);
+            k.set_or_remove(skill, value(rng));
+        }
+        dense.add(std::size_t(i), std::make_tuple(k));
+        paged.add(std::size_t(i), std::make_tuple(k));
+    }
+    REQUIRE(paged.get_seen_tree().size() == dense.get_seen_tree().size());
+    REQUIRE(paged.size() == dense.size());
+    std::set<std::size_t> dense_data;
+    std::set<std::size_t> paged_data;
+    for (const auto& e : dense) dense_data.emplace(e.second);
+    for (const auto& e : paged) paged_data.emplace(e.second);
+    REQUIRE(paged_data == dense_data);
+
+    // Trees too large to index must be rejected rather than silently wrapping around.
+    const std::vector<const Skill*> too_many_skills (32, &SkillsDatabase::g_skill_attack_boost);
+    REQUIRE_THROWS_AS(PagedMap(too_many_skills), std::runtime_error);
+}
+
+
+TEST_CASE("BitTreeCounterSubsetSeenMap generations match reading a copy") {
+    using SeenMap = Utils::BitTreeCounterSubsetSeenMap<std::size_t, SkillSecretLimitFn, SkillMap>;
+
+    const std::vector<const Skill*> skills = {&SkillsDatabase::g_skill_attack_boost,
+                                              &SkillsDatabase::g_skill_critical_eye,
+                                              &SkillsDatabase::g_skill_critical_boost };
+
+    std::mt19937 rng (777);
+    const auto random_key = [&](const unsigned int max_v){
+        SkillMap k;
+        for (const Skill * const skill : skills) {
+            std::uniform_int_distribution<unsigned int> value (0, std::min(max_v, skill->secret_limit));
+            k.set_or_remove(skill, value(rng));
+        }
+        return k;
+    };
+
+    // Data ids are unique, so the comparison below sees every entry. Initial ids are multiples of 5, and the id of
+    // an extension encodes its base id and increment without ever being a multiple of 5.
+    SeenMap expected (skills);
+    for (std::size_t i = 0; i < 50; ++i) {
+        expected.add(std::size_t(i * 5), std::make_tuple(random_key(2)));
+    }
+    SeenMap actual = expected.clone_empty();
+    for (const auto& e : expected) {
+        actual.add(std::size_t(e.second), std::make_tuple(std::get<0>(e.first)));
+    }
+
+    // Each pass extends every existing key by one of a few increments.
+    std::vector<SkillMap> increments;
+    for (std::size_t i = 0; i < 4; ++i) {
+        increments.emplace_back(random_key(1));
+    }
+    const auto extend = [&](SeenMap& dst, const SkillMap& k, const std::size_t d){
+        for (std::size_t i = 0; i < increments.size(); ++i) {
+            SkillMap x = k;
+            for (const Skill * const skill : skills) {
+                x.set_or_remove(skill, std::min(x.get(skill) + increments[i].get(skill), skill->secret_limit));
+            }
+            dst.add(std::size_t((d * 5) + i + 1), std::make_tuple(std::move(x)));
+        }
+    };
+
+    for (std::size_t pass = 0; pass < 3; ++pass) {
+        for (const auto& e : expected.get_data_as_vector()) {
+            extend(expected, std::get<0>(e.first), e.second);
+        }
+
+        SeenMap::Generation prev = actual.take_generation();
+        REQUIRE(actual.size() == 0);
+        for (const auto& node : prev) {
+            extend(actual, std::get<0>(node.key()), node.mapped());
+        }
+        actual.restore_generation(std::move(prev));
+
+        std::map<std::size_t, SkillMap> expected_data;
+        std::map<std::size_t, SkillMap> actual_data;
+        for (const auto& e : expected) expected_data.emplace(e.second, std::get<0>(e.first));
+        for (const auto& e : actual) actual_data.emplace(e.second, std::get<0>(e.first));
+        REQUIRE(expected_data.size() == expected.size());
+        REQUIRE(actual_data.size() == actual.size());
+        REQUIRE(actual_data == expected_data);
+    }
+
+    // Moving a generation into another map must keep the same entries as adding copies of it.
+    SeenMap copied = expected.clone_empty();
+    SeenMap moved = expected.clone_empty();
+    for (std::size_t i = 0; i < 20; ++i) {
+        // Far above the other ids. Some of these are supersets of the entries moved in, so those aren't kept.
+        const std::size_t id = (std::size_t(1) << 40) + i;
+        const SkillMap k = random_key(3);
+        copied.add(std::size_t(id), std::make_tuple(k));
+        moved.add(std::size_t(id), std::make_tuple(k));
+    }
+    for (const auto& e : actual) {
+        copied.add(std::size_t(e.second), std::make_tuple(std::get<0>(e.first)));
+    }
+    SeenMap::Generation g = actual.take_generation();
+    const std::size_t num_kept = moved.mark_generation(g);
+    g.erase(g.begin() + num_kept, g.end());
+    moved.restore_generation(std::move(g));
+
+    std::map<std::size_t, SkillMap> copied_data;
+    std::map<std::size_t, SkillMap> moved_data;
+    for (const auto& e : copied) copied_data.emplace(e.second, std::get<0>(e.first));
+    for (const auto& e : moved) moved_data.emplace(e.second, std::get<0>(e.first));
+    REQUIRE(copied_data.size() == copied.size());
+    REQUIRE(moved_data == copied_data);
+}
+
+
+TEST_CASE("Database snapshot round trip") {
+    const std::filesystem::path path = std::filesystem::temp_directory_path()
+                                       / ("mhwibs_test_database_" + std::to_string(std::random_device()()) + ".snapshot");
+    const std::string filename = path.string();
+    // Removes the snapshot even if a check below fails.
+    struct RemoveGuard {
+        const std::filesystem::path& path;
+        ~RemoveGuard() {
+            std::error_code ec;
+            std::filesystem::remove(this->path, ec);
+        }
+    } remove_guard {path};
+
+    const Database expected = Database::read_db_files();
+    expected.write_snapshot(filename, 12345);
+
+    REQUIRE_THROWS_AS(Database::read_snapshot(filename, 12346), std::runtime_error);
+    const Database actual = Database::read_snapshot(filename, 12345);
+
+    REQUIRE(actual.decos.get_all().size() == expected.decos.get_all().size());
+    for (const Decoration * const x : expected.decos.get_all()) {
+        const Decoration * const y = actual.decos.at(x->id);
+        REQUIRE(y->name == x->name);
+        REQUIRE(y->slot_size == x->slot_size);
+        REQUIRE(y->skills == x->skills);
+    }
+
+    const std::vector<const Weapon*> expected_weapons = expected.weapons.get_all();
+    const std::vector<const Weapon*> actual_weapons = actual.weapons.get_all();
+    REQUIRE(actual_weapons.size() == expected_weapons.size());
+    for (std::size_t i = 0; i < expected_weapons.size(); ++i) {
+        const Weapon& x = *expected_weapons[i];
+        const Weapon& y = *actual_weapons[i];
+        REQUIRE(y.id == x.id);
+        REQUIRE(y.weapon_class == x.weapon_class);
+        REQUIRE(y.name == x.name);
+        REQUIRE(y.true_raw == x.true_raw);
+        REQUIRE(y.affinity == x.affinity);
+        REQUIRE(y.elestat_type == x.elestat_type);
+        REQUIRE(y.elestat_value == x.elestat_value);
+        REQUIRE(y.deco_slots == x.deco_slots);
+        REQUIRE(y.skill == x.skill);
+        REQUIRE(y.maximum_sharpness.to_vector() == x.maximum_sharpness.to_vector());
+        REQUIRE(y.is_constant_sharpness == x.is_constant_sharpness);
+    }
+
+    const std::vector<const ArmourPiece*> expected_armour = expected.armour.get_all_pieces();
+    const std::vector<const ArmourPiece*> actual_armour = actual.armour.get_all_pieces();
+    REQUIRE(actual_armour.size() == expected_armour.size());
+    for (std::size_t i = 0; i < expected_armour.size(); ++i) {
+        const ArmourPiece& x = *expected_armour[i];
+        const ArmourPiece& y = *actual_armour[i];
+        REQUIRE(y.get_full_name() == x.get_full_name());
+        REQUIRE(y.variant == x.variant);
+        REQUIRE(y.deco_slots == x.deco_slots);
+        REQUIRE(y.skills == x.skills);
+        REQUIRE(y.set_bonus == x.set_bonus);
+        REQUIRE(y.set->tier == x.set->tier);
+    }
+
+    REQUIRE(actual.charms.get_all().size() == expected.charms.get_all().size());
+    for (const Charm * const x : expected.charms.get_all()) {
+        const Charm * const y = actual.charms.at(x->id);
+        REQUIRE(y->name == x->name);
+        REQUIRE(y->max_charm_lvl == x->max_charm_lvl);
+        REQUIRE(y->skills == x->skills);
+    }
+}
+
+
 } // namespace
 